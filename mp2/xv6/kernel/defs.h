@@ -62,8 +62,13 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
+void            kfree_zeroed(void *);
+void            kdup(void *);
+int             krefcnt(void *);
 void            kinit(void);
+int             kzero_idle(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -169,6 +174,9 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
+int             uvmiscow(pagetable_t, uint64);
+int             uvmlazy(pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -1,6 +1,19 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Debug builds (make DEBUG=1) fill pages with junk on
+// kalloc() and kfree() to catch dangling references.
+// Production builds skip the junk fill and instead keep
+// pages that are known to be all zeros on a separate list,
+// so kalloc_zeroed() can often hand out a page without
+// clearing it. Idle CPUs top that list up from the
+// scheduler loop; see kzero_idle().
+//
+// Each page has a reference count so that copy-on-write
+// fork can share a page between processes. kalloc() sets
+// it to 1, kdup() increments it, and kfree() only puts the
+// page back on a free list when it drops to 0.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +22,12 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define NZEROPOOL  256  // idle CPUs keep this many pages pre-zeroed
+#define NZEROBATCH   8  // pages zeroed per kzero_idle() call
+
+// index of the physical page pa in kmem.ref[]
+#define PA2REF(pa)  (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -20,7 +39,10 @@ struct run {
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *freelist;  // pages with unknown contents
+  struct run *zerolist;  // zeroed pages, apart from run.next
+  int nzero;             // length of zerolist
+  int ref[PA2REF(PHYSTOP)]; // references to each page
 } kmem;
 
 void
@@ -35,24 +57,74 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PA2REF(p)] = 1;
     kfree(p);
+  }
+}
+
+// Drop one reference to the page pa.
+// Returns the number of references left.
+static int
+kunref(void *pa, char *who)
+{
+  int ref;
+
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic(who);
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic(who);
+  ref = --kmem.ref[PA2REF(pa)];
+  release(&kmem.lock);
+  return ref;
+}
+
+// Add a reference to the allocated page pa,
+// which is now shared by one more page table.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic("kdup: free page");
+  kmem.ref[PA2REF(pa)]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to the page pa.
+int
+krefcnt(void *pa)
+{
+  int ref;
+
+  acquire(&kmem.lock);
+  ref = kmem.ref[PA2REF(pa)];
+  release(&kmem.lock);
+  return ref;
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A shared page is only freed by its last kfree().
 void
 kfree(void *pa)
 {
   struct run *r;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
-    panic("kfree");
+  if(kunref(pa, "kfree") > 0)
+    return;
 
+#ifdef DEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
@@ -62,9 +134,34 @@ kfree(void *pa)
   release(&kmem.lock);
 }
 
+// Free a page that the caller knows to be all zeros,
+// such as an empty page-table page.
+void
+kfree_zeroed(void *pa)
+{
+#ifdef DEBUG
+  kfree(pa);
+#else
+  struct run *r;
+
+  if(kunref(pa, "kfree_zeroed") > 0)
+    return;
+
+  r = (struct run*)pa;
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+#endif
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// Prefers pages of unknown contents, to save the
+// zeroed ones for kalloc_zeroed().
 void *
 kalloc(void)
 {
@@ -74,9 +171,86 @@ kalloc(void)
   r = kmem.freelist;
   if(r)
     kmem.freelist = r->next;
+  else if((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
+  if(r)
+    kmem.ref[PA2REF(r)] = 1;
   release(&kmem.lock);
 
+#ifdef DEBUG
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Allocate one zero-filled page of physical memory.
+// Only clears the page if it is not already known
+// to be zero.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  int zeroed = 0;
+
+#ifdef DEBUG
+  r = kalloc();
+#else
+  acquire(&kmem.lock);
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    zeroed = 1;
+  } else if((r = kmem.freelist) != 0)
+    kmem.freelist = r->next;
+  if(r)
+    kmem.ref[PA2REF(r)] = 1;
+  release(&kmem.lock);
+#endif
+
+  if(r == 0)
+    return 0;
+  if(zeroed)
+    r->next = 0;
+  else
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Called by scheduler() when it found nothing to run.
+// Moves a few pages from the free list to the zeroed list,
+// so that later kalloc_zeroed() calls, e.g. on a page fault,
+// need not clear them.
+// Returns the number of pages zeroed; 0 once the pool is full.
+int
+kzero_idle(void)
+{
+  int n = 0;
+
+#ifndef DEBUG
+  struct run *r;
+
+  for(; n < NZEROBATCH; n++){
+    acquire(&kmem.lock);
+    if(kmem.nzero >= NZEROPOOL || (r = kmem.freelist) == 0){
+      release(&kmem.lock);
+      break;
+    }
+    kmem.freelist = r->next;
+    release(&kmem.lock);
+
+    memset((char*)r, 0, PGSIZE);
+
+    acquire(&kmem.lock);
+    r->next = kmem.zerolist;
+    kmem.zerolist = r;
+    kmem.nzero++;
+    release(&kmem.lock);
+  }
+#endif
+  return n;
+}
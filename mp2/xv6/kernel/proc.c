@@ -247,6 +247,8 @@ userinit(void)
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; the pages are allocated
+// on first touch, see uvmlazy().
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -256,9 +258,9 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, 0)) == 0) {
+    if(sz + n > MMAP)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -281,7 +283,7 @@ fork(void)
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, 0, p->sz, 0) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, 0, p->sz, 1) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
@@ -487,7 +489,7 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
     
-    int nproc = 0;
+    int nproc = 0, found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
       if(p->state != UNUSED) {
@@ -499,6 +501,7 @@ scheduler(void)
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+        found = 1;
         swtch(&c->context, &p->context);
 
         // Process is done running for now.
@@ -507,6 +510,11 @@ scheduler(void)
       }
       release(&p->lock);
     }
+    // nothing was runnable: use the idle time to pre-zero
+    // free pages, and only wait for an interrupt once the
+    // zeroed page pool is full.
+    if(!found && kzero_idle() > 0)
+      continue;
     if(nproc <= 2) {   // only init and sh exist
       intr_on();
       asm volatile("wfi");
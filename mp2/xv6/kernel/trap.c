@@ -69,8 +69,17 @@ usertrap(void)
     uint64 addr = r_stval();
 
     // 13: load page fault
-    // 15: store/AMO page fault
-    if(mtrap(addr)){
+    // 15: store/AMO page fault, maybe to a copy-on-write page
+    if(r_scause() == 15 && uvmiscow(p->pagetable, addr)){
+      // the page is mapped, so neither the lazy heap nor
+      // mmap can help if there is no memory to copy it.
+      if(uvmcow(p->pagetable, addr) < 0){
+        printf("usertrap(): out of memory for copy-on-write pid=%d\n", p->pid);
+        p->killed = 1;
+      }
+    } else if(uvmlazy(p->pagetable, addr) == 0){
+      // first touch of a heap page
+    } else if(mtrap(addr)){
       printf("usertrap(): unexpected page fault at %p pid=%d\n", addr, p->pid);
       p->killed = 1;
     }
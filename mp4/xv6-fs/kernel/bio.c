@@ -1,12 +1,23 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers are hashed on (dev, blockno) into NBUCKET buckets,
+// each with its own spin-lock, so that lookups of different
+// blocks do not contend. A buffer records when it was last
+// released; a miss recycles the unused buffer with the oldest
+// timestamp among the next NSCAN unused buffers.
+//
+// binit() sizes the cache from the amount of free memory,
+// between NBUF and MAXBUF buffers, and allocates the block
+// data in whole pages.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To overwrite all of a block without reading it, call bgetw.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
@@ -23,69 +34,177 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+#define NBUCKET    1021
+#define NSCAN      64   // unused buffers examined per recycle
+#define BCACHEFRAC 8    // use up to 1/BCACHEFRAC of free memory
+#define BPP        (PGSIZE / BSIZE)  // buffers per data page
+#define HASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct bucket {
+  struct spinlock lock;  // protects the list and refcnt of its bufs
+  struct buf head;       // list of bufs, through prev/next
+  uint hit;
+  uint miss;
+};
+
+struct {
+  struct spinlock lock;  // serializes recycling of buffers
+  struct buf buf[MAXBUF];
+  int nbuf;              // number of buffers in use
+  int hand;              // where the next LRU scan starts
+  struct bucket bucket[NBUCKET];
 } bcache;
 
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
+  char *pg;
+  int i, n;
+
+  n = kfreepages() * BPP / BCACHEFRAC;
+  if(n < NBUF)
+    n = NBUF;
+  n = (n + BPP - 1) / BPP * BPP;
+  if(n > MAXBUF)
+    n = MAXBUF;
+  for(i = 0; i < n; i += BPP){
+    if((pg = kalloc()) == 0)
+      panic("binit: kalloc");
+    for(b = &bcache.buf[i]; b < &bcache.buf[i+BPP]; b++, pg += BSIZE)
+      b->data = (uchar*)pg;
+  }
+  bcache.nbuf = n;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // All buffers start out in the bucket of block 0.
+  bk = &bcache.bucket[HASH(0, 0)];
+  for(b = bcache.buf; b < bcache.buf+bcache.nbuf; b++){
+    b->next = bk->head.next;
+    b->prev = &bk->head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bk->head.next->prev = b;
+    bk->head.next = b;
   }
 }
 
+// Look for block blockno on device dev in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// With ahead set, return 0 instead of a cached buffer,
+// which the caller has no use for.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  struct bucket *bk, *old;
+  int i, n;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[HASH(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(ahead){
+      release(&bk->lock);
+      return 0;
     }
+    b->refcnt++;
+    bk->hit++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Only one process at a time may recycle a buffer, so check
+  // again in case another process cached the block meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(ahead){
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
+    }
+    b->refcnt++;
+    bk->hit++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  bk->miss++;
+  release(&bk->lock);
+
+  // Recycle the least recently used (LRU) of the next NSCAN
+  // unused buffers, so that a miss costs the same however big
+  // the cache is. refcnt and lastuse are read without the
+  // bucket lock, so re-check the choice under the lock of
+  // its bucket.
+  for(;;){
+    victim = 0;
+    for(i = 0, n = 0; i < bcache.nbuf && n < NSCAN; i++){
+      b = &bcache.buf[bcache.hand];
+      bcache.hand = (bcache.hand + 1) % bcache.nbuf;
+      if(b->refcnt == 0){
+        n++;
+        if(victim == 0 || b->lastuse < victim->lastuse)
+          victim = b;
+      }
     }
+    if(victim == 0)
+      panic("bget: no buffers");
+
+    old = &bcache.bucket[HASH(victim->dev, victim->blockno)];
+    acquire(&old->lock);
+    if(victim->refcnt == 0)
+      break;
+    release(&old->lock);
   }
-  panic("bget: no buffers");
+
+  // Move it from its old bucket to the new one.
+  victim->next->prev = victim->prev;
+  victim->prev->next = victim->next;
+  release(&old->lock);
+
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+
+  acquire(&bk->lock);
+  victim->next = bk->head.next;
+  victim->prev = &bk->head;
+  bk->head.next->prev = victim;
+  bk->head.next = victim;
+  release(&bk->lock);
+
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +213,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +221,48 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block, which the caller
+// is going to overwrite completely, without reading the block.
+// Unless the block was cached, b->valid is 0; the caller sets it
+// once all of b->data is filled in.
+struct buf*
+bgetw(uint dev, uint blockno)
+{
+  return bget(dev, blockno, 0);
+}
+
+// Called by the disk interrupt when a breadahead() finishes.
+// Like brelse(), but without a process to check ownership.
+static void
+bdone(struct buf *b)
+{
+  struct bucket *bk;
+
+  b->valid = 1;
+  releasesleep(&b->lock);
+
+  bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    b->lastuse = ticks;
+  }
+  release(&bk->lock);
+}
+
+// Start reading a block into the cache without waiting for it,
+// unless it is cached already.
+// The buffer stays locked until the disk interrupt calls bdone(),
+// so a bread() of the same block sleeps until the data is there.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) != 0)
+    virtio_disk_submit(b, 0, bdone);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +272,90 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing the contents of the n bufs in bv to disk,
+// without waiting. Bufs for consecutive blocks, in order,
+// are written by one disk request. All must be locked, and
+// bwrite_wait() must be called on each before brelse().
+void
+bwrite_start(struct buf **bv, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bv[i]->lock))
+      panic("bwrite_start");
+  }
+  virtio_disk_submitv(bv, n, 1, 0);
+}
+
+// Wait for the bwrite_start() of b to finish.
+void
+bwrite_wait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Record when it was last used, for LRU recycling.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Return the number of buffers in the cache.
+int
+bcachesize(void)
+{
+  return bcache.nbuf;
+}
 
+// Print buffer cache hit rate and lock statistics, for lockstat().
+void
+bcachestat(void)
+{
+  struct bucket *bk;
+  uint hit = 0, miss = 0, n = 0, nts = 0;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    hit += bk->hit;
+    miss += bk->miss;
+    n += bk->lock.n;
+    nts += bk->lock.nts;
+  }
+  printf("bcache: %d buffers #hit %d #miss %d\n", bcache.nbuf, hit, miss);
+  printf("bcache.bucket: #acquire %d #spin %d\n", n, nts);
+  printf("bcache: #acquire %d #spin %d\n", bcache.lock.n, bcache.lock.nts);
+}
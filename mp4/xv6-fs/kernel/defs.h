@@ -12,10 +12,16 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetw(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bcachestat(void);
+int             bcachesize(void);
+void            breadahead(uint, uint);
+void            bwrite_start(struct buf**, int);
+void            bwrite_wait(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -33,9 +39,13 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filefallocate(struct file*, uint, uint);
 
 // fs.c
 void            fsinit(int);
+int             bfreecount(void);
+void            dcachestat(void);
+void            dinval(struct inode*, char*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -50,8 +60,10 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*, int);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+uint            readahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             iprealloc(struct inode*, uint, uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -63,12 +75,21 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kallocstat(void);
+int             kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_write_data(struct buf*);
+void            log_free(uint);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+void            log_flush(void);
+void            log_crash(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -99,6 +120,7 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kproc(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -182,6 +204,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int, void (*)(struct buf *));
+void            virtio_disk_submitv(struct buf **, int, int, void (*)(struct buf *));
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -119,8 +119,26 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    // A read that starts where the last one ended is sequential:
+    // grow the read-ahead window. Any other read closes it.
+    if(f->off == f->seqoff){
+      f->ra = f->ra ? f->ra * 2 : 2;
+      if(f->ra > NREADAHEAD)
+        f->ra = NREADAHEAD;
+    } else {
+      f->ra = 0;
+      f->ranext = 0;
+    }
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    f->seqoff = f->off;
+    if(r > 0 && f->ra > 0){
+      uint bn = f->off / BSIZE;
+      if(f->ranext < bn)
+        f->ranext = bn;
+      if(f->ranext < bn + f->ra)
+        f->ranext = readahead(f->ip, f->ranext, bn + f->ra - f->ranext);
+    }
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -146,25 +164,26 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
+    // write as many blocks at a time as one operation
+    // may put in the log, including
     // i-node, indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int nop = log_maxop();
+    int max = ((nop-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opn(nop);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nop);
 
       if(r != n1){
         // error from writei
@@ -180,3 +199,48 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Preallocate the blocks of bytes off..off+len-1 of file f,
+// without changing its size, so that they are contiguous on
+// disk when they are written. off must not be beyond the end.
+int
+filefallocate(struct file *f, uint off, uint len)
+{
+  struct inode *ip = f->ip;
+  uint bn, end, n;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  if(off + len < off || off + len > MAXFILE*BSIZE)
+    return -1;
+
+  // allocate as many blocks at a time as one operation may
+  // put in the log, counting as filewrite() does, though
+  // the blocks themselves are not logged.
+  int nop = log_maxop();
+  int max = (nop-1-1-2) / 2;
+  bn = off / BSIZE;
+  end = (off + len + BSIZE - 1) / BSIZE;
+  while(bn < end){
+    n = end - bn;
+    if(n > max)
+      n = max;
+
+    begin_opn(nop);
+    ilock(ip);
+    if(ip->type != T_FILE || off > ip->size){
+      iunlock(ip);
+      end_opn(nop);
+      return -1;
+    }
+    if(iprealloc(ip, bn, n) < 0){
+      iunlock(ip);
+      end_opn(nop);
+      return -1;
+    }
+    iunlock(ip);
+    end_opn(nop);
+    bn += n;
+  }
+  return 0;
+}
+
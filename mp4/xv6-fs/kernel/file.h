@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint seqoff;       // FD_INODE: off after the last read
+  uint ra;           // FD_INODE: read-ahead window, in blocks
+  uint ranext;       // FD_INODE: next block to read ahead
   short major;       // FD_DEVICE
 };
 
@@ -13,6 +16,8 @@ struct file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+#define NBMAPRUN 4  // runs of blocks cached by bmap() per inode
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
@@ -30,6 +35,9 @@ struct inode {
                          // addrs[10]:  indirect block
                          // addrs[11]:  2-level indirect block
                          // addrs[12]:  3-level indirect block
+  uint goal;          // where to allocate the next block, or 0
+  struct extent run[NBMAPRUN]; // recently mapped runs of blocks
+  int nextrun;        // run[] entry to replace next
 };
 
 // map major device number to device functions.
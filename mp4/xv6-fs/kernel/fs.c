@@ -26,6 +26,28 @@
 // only one device
 struct superblock sb; 
 
+#define NBITMAP (FSSIZE/BPB + 1)  // most bitmap blocks
+
+// In-memory summary of the free-block bitmap, built by
+// fsinit(), so that balloc() skips bitmap blocks without
+// free blocks instead of reading them.
+struct {
+  struct spinlock lock;
+  int nfree[NBITMAP];  // free blocks in each bitmap block
+  uint next;           // where the next search starts
+} freemap;
+
+// The orphan list; see iorphan().
+struct {
+  struct spinlock lock;  // protects sb.orphan
+  int dev;
+} orphans;
+
+static void freemapinit(int);
+static void orphan_reaper(void);
+static void dinit(void);
+static void dpurge(uint, uint);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +66,13 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  // recovery may have installed a newer superblock, with
+  // another head of the orphan list.
+  readsb(dev, &sb);
+  freemapinit(dev);
+  initlock(&orphans.lock, "orphans");
+  orphans.dev = dev;
+  kproc(orphan_reaper, "reaper");
 }
 
 // Zero a block.
@@ -60,46 +89,150 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// Count the free blocks in each bitmap block.
+static void
+freemapinit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi, *map;
 
-  bp = 0;
+  initlock(&freemap.lock, "freemap");
+  if(sb.size > NBITMAP*BPB)
+    panic("freemapinit: file system too big");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
+    map = (uint*)bp->data;
+    freemap.nfree[b/BPB] = 0;
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      if(bi % 32 == 0 && map[bi/32] == ~0U)
+        bi += 31;  // a word of blocks in use
+      else if((map[bi/32] & (1U << (bi % 32))) == 0)
+        freemap.nfree[b/BPB]++;
+    }
+    brelse(bp);
+  }
+  freemap.next = 0;
+}
+
+// Return the number of free blocks.
+int
+bfreecount(void)
+{
+  int i, n = 0;
+
+  acquire(&freemap.lock);
+  for(i = 0; i < NBITMAP; i++)
+    n += freemap.nfree[i];
+  release(&freemap.lock);
+  return n;
+}
+
+// Return the index of the lowest set bit of x, which is not 0.
+static int
+lowbit(uint x)
+{
+  int i;
+
+  for(i = 0; (x & 1) == 0; i++)
+    x >>= 1;
+  return i;
+}
+
+// Allocate a disk block, zeroed unless zero is 0 because
+// the caller is going to overwrite all of it.
+// The search starts at block goal, if it is not 0, and
+// otherwise where the last such search left off (next fit).
+// It skips bitmap blocks that freemap says are full, and tests
+// the bitmap a word of 32 blocks at a time; bit bi of the
+// little-endian word w is block w*32 + bi.
+static uint
+balloc(uint dev, int zero, uint goal)
+{
+  int i, n, bn, nfree;
+  uint b, first, w, bits, *map;
+  struct buf *bp;
+
+  n = (sb.size + BPB - 1) / BPB;
+  acquire(&freemap.lock);
+  first = freemap.next;
+  release(&freemap.lock);
+  if(goal > 0 && goal < sb.size)
+    first = goal;
+
+  // the first bitmap block is visited twice, to look before
+  // first after wrapping around.
+  for(i = 0; i <= n; i++){
+    bn = (first/BPB + i) % n;
+    acquire(&freemap.lock);
+    nfree = freemap.nfree[bn];
+    release(&freemap.lock);
+    if(nfree == 0)
+      continue;
+
+    bp = bread(dev, sb.bmapstart + bn);
+    map = (uint*)bp->data;
+    w = (i == 0) ? (first % BPB) / 32 : 0;
+    for(; w < BPB/32; w++){
+      bits = map[w];
+      if(i == 0 && w == (first % BPB) / 32)
+        bits |= (1U << (first % 32)) - 1;  // before first
+      if(bits == ~0U)
+        continue;
+      b = bn*BPB + w*32 + lowbit(~bits);
+      if(b >= sb.size)
+        break;
+      map[w] |= 1U << (b % 32);  // Mark block in use.
+      log_write(bp);
+      acquire(&freemap.lock);
+      freemap.nfree[bn]--;
+      if(goal == 0)
+        freemap.next = (b + 1) % sb.size;
+      release(&freemap.lock);
+      brelse(bp);
+      if(zero)
+        bzero(dev, b);
+      return b;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Free the n disk blocks from b, reading each bitmap
+// block only once.
 static void
-bfree(int dev, uint b)
+bfreen(int dev, uint b, uint n)
 {
   struct buf *bp;
+  uint start, end = b + n;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  while(b < end){
+    start = b;
+    bp = bread(dev, BBLOCK(b, sb));
+    do {
+      bi = b % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      b++;
+    } while(b < end && b % BPB != 0);
+    log_write(bp);
+    acquire(&freemap.lock);
+    freemap.nfree[start/BPB] += b - start;
+    release(&freemap.lock);
+    brelse(bp);
+    for(; start < b; start++)
+      log_free(start);
+  }
+}
+
+// Free a disk block.
+static void
+bfree(int dev, uint b)
+{
+  bfreen(dev, b, 1);
 }
 
 // Inodes.
@@ -174,6 +307,7 @@ bfree(int dev, uint b)
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  uint inext;            // where ialloc() starts looking
 } itable;
 
 void
@@ -185,21 +319,34 @@ iinit()
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
+  dinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void bmapinval(struct inode*);
+static int ismall(struct inode*);
+static void iorphan(struct inode*);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there is no free inode.
+// The search starts after the inode allocated last, so that
+// creating many files does not rescan the allocated ones.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int i, inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  acquire(&itable.lock);
+  inum = itable.inext;
+  release(&itable.lock);
+  if(inum < 1 || inum >= sb.ninodes)
+    inum = 1;
+
+  for(i = 1; i < sb.ninodes; i++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -207,11 +354,16 @@ ialloc(uint dev, short type)
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      acquire(&itable.lock);
+      itable.inext = inum + 1;
+      release(&itable.lock);
       return iget(dev, inum);
     }
     brelse(bp);
+    if(++inum == sb.ninodes)
+      inum = 1;
   }
-  panic("ialloc: no inodes");
+  return 0;
 }
 
 // Copy a modified in-memory inode to disk.
@@ -267,6 +419,8 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->goal = 0;
+  bmapinval(ip);
   release(&itable.lock);
 
   return ip;
@@ -334,8 +488,10 @@ iput(struct inode *ip)
 {
   acquire(&itable.lock);
 
-  if(ip->ref == 1 && ip->valid && ip->nlink == 0){
+  if(ip->ref == 1 && ip->valid && ip->nlink == 0 && ip->type != T_ORPHAN){
     // inode has no links and no other references: truncate and free.
+    // A big file goes on the orphan list instead, to be
+    // truncated and freed in the background.
 
     // ip->ref == 1 means no other process can have ip locked,
     // so this acquiresleep() won't block (or deadlock).
@@ -343,9 +499,13 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
+    dpurge(ip->dev, ip->inum);
+    if(ismall(ip)){
+      itrunc(ip);
+      ip->type = 0;
+      iupdate(ip);
+    } else
+      iorphan(ip);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -372,20 +532,293 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Allocate a block for inode ip, preferably the one after
+// the block last allocated for it, so that a file written
+// sequentially, with its indirect blocks, is contiguous on
+// disk. The block is zeroed unless zero is 0.
 static uint
-bmap(struct inode *ip, uint bn)
+bnew(struct inode *ip, int zero)
+{
+  uint b;
+
+  b = balloc(ip->dev, zero, ip->goal);
+  ip->goal = b + 1;
+  return b;
+}
+
+// Allocate a data block for bmapw(). With fresh set, the
+// caller overwrites the whole block, so it is not zeroed,
+// and *fresh is set to say so.
+static uint
+bdata(struct inode *ip, int *fresh)
+{
+  bmapinval(ip);
+  if(fresh == 0)
+    return bnew(ip, 1);
+  *fresh = 1;
+  return bnew(ip, 0);
+}
+
+// The block-map cache.
+//
+// Each in-memory inode remembers the last NBMAPRUN runs of
+// contiguous blocks that bmapw() looked up in indirect or
+// extent leaf blocks, so that later lookups in the same run
+// need not read those blocks again. Allocating a block or
+// truncating the file empties the cache.
+// Caller must hold ip->lock.
+
+// Return the disk block of file block bn if the cache has it,
+// or 0.
+static uint
+bmapcached(struct inode *ip, uint bn)
+{
+  struct extent *r;
+
+  for(r = ip->run; r < ip->run+NBMAPRUN; r++){
+    if(r->len > 0 && bn >= r->lblk && bn < r->lblk + r->len)
+      return r->pblk + bn - r->lblk;
+  }
+  return 0;
+}
+
+// Remember that the len file blocks from lblk are the disk
+// blocks from pblk, in place of the oldest run.
+static void
+bmapcache(struct inode *ip, uint lblk, uint pblk, uint len)
+{
+  struct extent *r = &ip->run[ip->nextrun];
+
+  r->lblk = lblk;
+  r->pblk = pblk;
+  r->len = len;
+  ip->nextrun = (ip->nextrun + 1) % NBMAPRUN;
+}
+
+// Cache the run of contiguous blocks around a[i], which is
+// file block bn, in the n block addresses at a.
+static void
+bmaprun(struct inode *ip, uint bn, uint *a, int i, int n)
+{
+  int lo = i, hi = i + 1;
+
+  while(lo > 0 && a[lo-1] != 0 && a[lo-1] + 1 == a[lo])
+    lo--;
+  while(hi < n && a[hi] != 0 && a[hi] == a[hi-1] + 1)
+    hi++;
+  bmapcache(ip, bn - (i - lo), a[lo], hi - lo);
+}
+
+// Empty ip's block-map cache.
+static void
+bmapinval(struct inode *ip)
+{
+  memset(ip->run, 0, sizeof(ip->run));
+  ip->nextrun = 0;
+}
+
+// Extent files.
+//
+// On an FS_EXTENT file system the blocks of a file are always
+// mapped from block 0 up, since writei() and iprealloc() never
+// leave holes. So extents are only ever added at the end, and
+// a lookup searches the extents in the inode and at most the
+// index block and one leaf.
+
+// Return the number of used extents among the n at e.
+static int
+nextents(struct extent *e, int n)
+{
+  int lo = 0, hi = n, mid;
+
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(e[mid].len > 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Return the index of the last of the n extents at e that
+// starts at or before file block bn, or -1 if there is none.
+static int
+efind(struct extent *e, int n, uint bn)
+{
+  int lo = 0, hi = n, mid;
+
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(e[mid].lblk <= bn)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+// bmapw() for an extent file.
+// Returns 0 if the block needs a new extent and there is
+// no room for one.
+static uint
+ebmap(struct inode *ip, uint bn, int *fresh)
+{
+  struct extent *e = (struct extent*)ip->addrs, *x, *le, *last;
+  struct buf *ib = 0, *lb = 0;
+  uint addr = 0;
+  int i, n;
+
+  n = nextents(e, NEXTENT);
+  i = efind(e, n, bn);
+  if(i >= 0 && bn < e[i].lblk + e[i].len)
+    return e[i].pblk + bn - e[i].lblk;
+  last = n > 0 ? &e[n-1] : 0;
+
+  if(ip->addrs[EXTIDX]){
+    ib = bread(ip->dev, ip->addrs[EXTIDX]);
+    x = (struct extent*)ib->data;
+    n = nextents(x, NEXTLEAF);
+    i = efind(x, n, bn);
+    if(i >= 0){
+      lb = bread(ip->dev, x[i].pblk);
+      le = (struct extent*)lb->data;
+      last = &le[x[i].len - 1];
+      i = efind(le, x[i].len, bn);
+      if(i >= 0 && bn < le[i].lblk + le[i].len){
+        addr = le[i].pblk + bn - le[i].lblk;
+        bmapcache(ip, le[i].lblk, le[i].pblk, le[i].len);
+      }
+    }
+  }
+
+  // Not mapped: bn must be the block after the last one.
+  if(addr == 0){
+    if(bn != (last ? last->lblk + last->len : 0))
+      panic("ebmap: hole");
+    if(ip->goal == 0 && last)
+      ip->goal = last->pblk + last->len;
+    addr = bdata(ip, fresh);
+    if(last && addr == last->pblk + last->len){
+      last->len++;  // the disk blocks are contiguous too
+      if(lb)
+        log_write(lb);
+    } else if(ib == 0 && (n = nextents(e, NEXTENT)) < NEXTENT){
+      e[n].lblk = bn;
+      e[n].pblk = addr;
+      e[n].len = 1;
+    } else {
+      if(ib == 0){
+        ip->addrs[EXTIDX] = bnew(ip, 1);
+        ib = bread(ip->dev, ip->addrs[EXTIDX]);
+      }
+      x = (struct extent*)ib->data;
+      n = nextents(x, NEXTLEAF);
+      if(n == 0 || x[n-1].len == NEXTLEAF){
+        if(n == NEXTLEAF){
+          // every leaf is full: the file cannot grow.
+          bfree(ip->dev, addr);
+          addr = 0;
+          goto out;
+        }
+        if(lb)
+          brelse(lb);
+        x[n].lblk = bn;
+        x[n].pblk = bnew(ip, 1);
+        x[n].len = 0;
+        lb = bread(ip->dev, x[n].pblk);
+        n++;
+      }
+      le = (struct extent*)lb->data;
+      le[x[n-1].len].lblk = bn;
+      le[x[n-1].len].pblk = addr;
+      le[x[n-1].len].len = 1;
+      x[n-1].len++;
+      log_write(lb);
+      log_write(ib);
+    }
+  }
+
+out:
+  if(lb)
+    brelse(lb);
+  if(ib)
+    brelse(ib);
+  return addr;
+}
+
+// Free up to budget blocks of the *n extents at e, from the
+// end, and drop the extents that this empties.
+// Returns what is left of the budget.
+static int
+efreen(struct inode *ip, struct extent *e, uint *n, int budget)
+{
+  struct extent *last;
+  uint k;
+
+  while(*n > 0 && budget > 0){
+    last = &e[*n-1];
+    k = last->len < budget ? last->len : budget;
+    last->len -= k;
+    bfreen(ip->dev, last->pblk + last->len, k);
+    budget -= k;
+    if(last->len == 0)
+      (*n)--;
+  }
+  return budget;
+}
+
+// ifree() for an extent file.
+static int
+efree(struct inode *ip, int budget)
+{
+  struct extent *e = (struct extent*)ip->addrs, *x;
+  struct buf *ib, *lb;
+  uint n;
+
+  if(ip->addrs[EXTIDX]){
+    ib = bread(ip->dev, ip->addrs[EXTIDX]);
+    x = (struct extent*)ib->data;
+    n = nextents(x, NEXTLEAF);
+    while(n > 0 && budget > 0){
+      lb = bread(ip->dev, x[n-1].pblk);
+      budget = efreen(ip, (struct extent*)lb->data, &x[n-1].len, budget);
+      log_write(lb);
+      brelse(lb);
+      if(x[n-1].len > 0)
+        break;
+      bfree(ip->dev, x[n-1].pblk);
+      budget--;
+      n--;
+    }
+    if(n > 0){
+      log_write(ib);
+      brelse(ib);
+      return 0;
+    }
+    brelse(ib);
+    bfree(ip->dev, ip->addrs[EXTIDX]);
+    ip->addrs[EXTIDX] = 0;
+    budget--;
+  }
+  n = nextents(e, NEXTENT);
+  efreen(ip, e, &n, budget);
+  return n == 0;
+}
+
+// bmapw() for a file that maps its blocks with indirect blocks.
+static uint
+ibmap(struct inode *ip, uint bn, int *fresh)
 {
   // TODO: Large Files
   // You should modify bmap(),
   // so that it can handle doubly indrect inode.
-  uint addr, *a;
+  uint addr, *a, lbn = bn;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = bdata(ip, fresh);
     return addr;
   }
   bn -= NDIRECT;
@@ -393,13 +826,14 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = bnew(ip, 1);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = bdata(ip, fresh);
       log_write(bp);
-    }
+    } else
+      bmaprun(ip, lbn, a, bn, NINDIRECT);
     brelse(bp);
     return addr;
   }
@@ -408,20 +842,21 @@ bmap(struct inode *ip, uint bn)
   // load 2-level indirect block
   if(bn < NINDIRECT_2LV){
     if((addr = ip->addrs[NDIRECT+1]) == 0)
-      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT+1] = addr = bnew(ip, 1);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn/NINDIRECT]) == 0){
-      a[bn/NINDIRECT] = addr = balloc(ip->dev);
+      a[bn/NINDIRECT] = addr = bnew(ip, 1);
       log_write(bp);
     }
     brelse(bp);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn%NINDIRECT]) == 0){
-      a[bn%NINDIRECT] = addr = balloc(ip->dev);
+      a[bn%NINDIRECT] = addr = bdata(ip, fresh);
       log_write(bp);
-    }
+    } else
+      bmaprun(ip, lbn, a, bn%NINDIRECT, NINDIRECT);
     brelse(bp);
     return addr;
   }
@@ -430,27 +865,28 @@ bmap(struct inode *ip, uint bn)
   // load 3-level indirect block
   if(bn < NINDIRECT_3LV){
     if((addr = ip->addrs[NDIRECT+2]) == 0)
-      ip->addrs[NDIRECT+2] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT+2] = addr = bnew(ip, 1);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn/(NINDIRECT*NINDIRECT)]) == 0){
-      a[bn/(NINDIRECT*NINDIRECT)] = addr = balloc(ip->dev);
+      a[bn/(NINDIRECT*NINDIRECT)] = addr = bnew(ip, 1);
       log_write(bp);
     }
     brelse(bp);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[(bn/NINDIRECT)%NINDIRECT]) == 0){
-      a[(bn/NINDIRECT)%NINDIRECT] = addr = balloc(ip->dev);
+      a[(bn/NINDIRECT)%NINDIRECT] = addr = bnew(ip, 1);
       log_write(bp);
     }
     brelse(bp);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn%NINDIRECT]) == 0){
-      a[bn%NINDIRECT] = addr = balloc(ip->dev);
+      a[bn%NINDIRECT] = addr = bdata(ip, fresh);
       log_write(bp);
-    }
+    } else
+      bmaprun(ip, lbn, a, bn%NINDIRECT, NINDIRECT);
     brelse(bp);
     return addr;
   }
@@ -458,88 +894,244 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmapw allocates one, or returns
+// 0 if the file cannot map any more blocks.
+// With fresh set, the caller is going to overwrite the block
+// completely, so an allocated block is not zeroed and *fresh
+// is set to 1; the caller must zero it after all if it fails
+// to write it.
+static uint
+bmapw(struct inode *ip, uint bn, int *fresh)
 {
-  // TODO: Large Files
-  // You should modify itruc(),
-  // so that it can handle doubly indrect inode.
-  int i, j, k;
-  struct buf *bp, *bp2, *bp3;
-  uint *a, *a2, *a3;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
+  uint addr;
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  if((addr = bmapcached(ip, bn)) != 0)
+    return addr;
+  if(sb.flags & FS_EXTENT)
+    return ebmap(ip, bn, fresh);
+  return ibmap(ip, bn, fresh);
+}
+
+// Return the disk block address of the nth block in inode ip,
+// allocating a zeroed block if there is none, or 0 as bmapw().
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  return bmapw(ip, bn, 0);
+}
+
+// Free up to *budget blocks of the tree under indirect block
+// addr, which has level levels of indirect blocks, from the end.
+// Returns 1 if it freed the whole tree, addr included.
+static int
+ifreetree(struct inode *ip, uint addr, int level, int *budget)
+{
+  struct buf *bp;
+  uint *a;
+  int i, dirty = 0;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(i = NINDIRECT-1; i >= 0; i--){
+    if(a[i] == 0)
+      continue;
+    if(*budget <= 0)
+      break;
+    if(level > 1 && !ifreetree(ip, a[i], level-1, budget))
+      break;
+    if(level == 1){
+      bfree(ip->dev, a[i]);
+      (*budget)--;
     }
+    a[i] = 0;
+    dirty = 1;
+  }
+  if(i >= 0){
+    if(dirty)
+      log_write(bp);
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    return 0;
   }
+  brelse(bp);
+  bfree(ip->dev, addr);
+  (*budget)--;
+  return 1;
+}
 
-  // free 2-level indirect block
-  if(ip->addrs[NDIRECT+1]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
-    a = (uint*)bp->data;
-    for(i = 0; i < NINDIRECT; i++){
-      if(a[i]){
-        bp2 = bread(ip->dev, a[i]);
-        a2 = (uint*)bp2->data;
-        for(j = 0; j < NINDIRECT; j++){
-          if(a2[j])
-            bfree(ip->dev, a2[j]);
-        }
-        brelse(bp2);
-        bfree(ip->dev, a[i]);
-      }
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT+1]);
-    ip->addrs[NDIRECT+1] = 0;
+// ifree() for a file that maps its blocks with indirect blocks.
+static int
+ibfree(struct inode *ip, int budget)
+{
+  int i;
+
+  for(i = 2; i >= 0; i--){
+    if(ip->addrs[NDIRECT+i] == 0)
+      continue;
+    if(budget <= 0 || !ifreetree(ip, ip->addrs[NDIRECT+i], i+1, &budget))
+      return 0;
+    ip->addrs[NDIRECT+i] = 0;
+  }
+  for(i = NDIRECT-1; i >= 0; i--){
+    if(ip->addrs[i] == 0)
+      continue;
+    if(budget-- <= 0)
+      return 0;
+    bfree(ip->dev, ip->addrs[i]);
+    ip->addrs[i] = 0;
   }
+  return 1;
+}
 
-  // free 3-level indirect block
-  if(ip->addrs[NDIRECT+2]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT+2]);
-    a = (uint*)bp->data;
-    for(i = 0; i < NINDIRECT; i++){
-      if(a[i]){
-        bp2 = bread(ip->dev, a[i]);
-        a2 = (uint*)bp2->data;
-        for(j = 0; j < NINDIRECT; j++){
-          if(a2[j]){
-            bp3 = bread(ip->dev, a2[j]);
-            a3 = (uint*)bp3->data;
-            for(k = 0; k < NINDIRECT; k++){
-              if(a3[k])
-                bfree(ip->dev, a3[k]);
-            }
-            brelse(bp3);
-            bfree(ip->dev, a2[j]);
-          }
-        }
-        brelse(bp2);
-        bfree(ip->dev, a[i]);
+// Free up to budget blocks of inode ip, data and indirect
+// blocks alike, from the end of the file, so that ip maps
+// the rest. Returns 1 once ip has no blocks left.
+// Caller must hold ip->lock.
+static int
+ifree(struct inode *ip, int budget)
+{
+  if(sb.flags & FS_EXTENT)
+    return efree(ip, budget);
+  return ibfree(ip, budget);
+}
+
+// Whether ip has few enough blocks, none of them indirect,
+// for itrunc() to free them in the caller's transaction.
+static int
+ismall(struct inode *ip)
+{
+  struct extent *e = (struct extent*)ip->addrs;
+  uint i, n = 0;
+
+  if(sb.flags & FS_EXTENT){
+    if(ip->addrs[EXTIDX])
+      return 0;
+    for(i = 0; i < NEXTENT; i++)
+      n += e[i].len;
+    return n <= NDIRECT;
+  }
+  for(i = NDIRECT; i < NDIRECT+3; i++){
+    if(ip->addrs[i])
+      return 0;
+  }
+  return 1;
+}
+
+// The orphan list.
+//
+// Freeing the blocks of a big file takes more log blocks than
+// one transaction may use. So iput() and itrunc() put an inode
+// whose blocks are to be freed on the orphan list instead, and
+// orphan_reaper() frees them a transaction at a time, in the
+// background. The list is on disk, so that the work is done
+// after a crash too: sb.orphan is the first inode on the list,
+// and the major of each inode the next one. An inode on the
+// list has type T_ORPHAN, and is only freed once it is first
+// on the list.
+
+// Add ip, which is locked and has no links, to the orphan list.
+// ip keeps its blocks.
+static void
+iorphan(struct inode *ip)
+{
+  struct buf *bp;
+
+  ip->type = T_ORPHAN;
+  bp = bread(ip->dev, 1);
+  acquire(&orphans.lock);
+  ip->major = sb.orphan;
+  sb.orphan = ip->inum;
+  memmove(bp->data, &sb, sizeof(sb));
+  wakeup(&orphans);
+  release(&orphans.lock);
+  log_write(bp);
+  brelse(bp);
+  iupdate(ip);
+}
+
+// Take ip off the orphan list if it is first on it.
+// Returns 1 if it was.
+static int
+iunorphan(struct inode *ip)
+{
+  struct buf *bp;
+  int first;
+
+  bp = bread(ip->dev, 1);
+  acquire(&orphans.lock);
+  if((first = (sb.orphan == ip->inum)) != 0){
+    sb.orphan = ip->major;
+    memmove(bp->data, &sb, sizeof(sb));
+  }
+  release(&orphans.lock);
+  if(first)
+    log_write(bp);
+  brelse(bp);
+  return first;
+}
+
+// Kernel process that frees the blocks of the inodes on the
+// orphan list, and then the inodes, a few blocks at a time.
+static void
+orphan_reaper(void)
+{
+  struct inode *ip;
+  uint inum;
+  int nop;
+
+  for(;;){
+    acquire(&orphans.lock);
+    while(sb.orphan == 0)
+      sleep(&orphans, &orphans.lock);
+    inum = sb.orphan;
+    release(&orphans.lock);
+
+    nop = log_maxop();
+    begin_opn(nop);
+    ip = iget(orphans.dev, inum);
+    ilock(ip);
+    // each block freed may dirty a bitmap block; leave room
+    // for the inode, the superblock and the blocks of the map.
+    if(ifree(ip, nop - 8)){
+      memset(ip->addrs, 0, sizeof(ip->addrs));
+      if(iunorphan(ip)){
+        ip->type = 0;
+        ip->major = 0;
       }
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT+2]);
-    ip->addrs[NDIRECT+2] = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    end_opn(nop);
   }
+}
 
+// Truncate inode (discard contents).
+// The blocks of a big file are freed later, by orphan_reaper(),
+// through an orphan inode that takes them over.
+// If there is no free inode for that, itrunc() frees as many
+// blocks as the caller's transaction has room for, from the
+// end. The rest stay mapped beyond the new end of the file,
+// where readi() does not look and writei() reuses them, until
+// the file is truncated again or freed.
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  struct inode *op;
+
+  if(ip->type == T_SYMLINK)
+    dpurge(ip->dev, ip->inum);
+  if(!ismall(ip) && (op = ialloc(ip->dev, T_ORPHAN)) != 0){
+    ilock(op);
+    memmove(op->addrs, ip->addrs, sizeof(ip->addrs));
+    iorphan(op);
+    iunlockput(op);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  } else if(ifree(ip, NDIRECT))  // all of a small file
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  bmapinval(ip);
   ip->size = 0;
+  ip->goal = 0;
   iupdate(ip);
 }
 
@@ -583,6 +1175,21 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading n blocks of ip from block bn on into the
+// buffer cache, without waiting, for a sequential reader.
+// Stops early at the end of the file.
+// Returns the number of the first block not started.
+// Caller must hold ip->lock.
+uint
+readahead(struct inode *ip, uint bn, uint n)
+{
+  uint end = (ip->size + BSIZE - 1) / BSIZE;
+
+  for(; n > 0 && bn < end; n--, bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+  return bn;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -593,22 +1200,49 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
+  int fresh;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // the name cache may hold the target of a symbolic link.
+  if(ip->type == T_SYMLINK)
+    dpurge(ip->dev, ip->inum);
+
+  // carry on allocating after the block that off follows.
+  if(ip->goal == 0 && off > 0)
+    ip->goal = bmap(ip, (off-1)/BSIZE) + 1;
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    // no need to read, or to zero when allocating, a block
+    // that is overwritten completely.
+    fresh = 0;
+    if((addr = bmapw(ip, off/BSIZE, m == BSIZE ? &fresh : 0)) == 0)
+      break;
+    if(m == BSIZE)
+      bp = bgetw(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      if(fresh){
+        // don't leave the old owner's data in the new block.
+        memset(bp->data, 0, BSIZE);
+        bp->valid = 1;
+        log_write(bp);
+      }
       brelse(bp);
       break;
     }
-    log_write(bp);
+    bp->valid = 1;
+    if(ip->type == T_FILE)
+      log_write_data(bp);
+    else
+      log_write(bp);   // directory entries and symlinks are metadata
     brelse(bp);
   }
 
@@ -623,6 +1257,348 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// Allocate whichever of blocks bn..bn+n-1 of inode ip it
+// does not have yet, for fallocate(). bn*BSIZE must not be
+// beyond ip->size. The blocks are not zeroed: ip->size stays
+// as it is, and writei() writes the bytes beyond it before
+// they can be read.
+// Returns -1 if the file cannot map all of them.
+// Caller must hold ip->lock, in a transaction with room for
+// n bitmap blocks and the indirect blocks.
+int
+iprealloc(struct inode *ip, uint bn, uint n)
+{
+  int fresh;
+
+  if(ip->goal == 0 && bn > 0)
+    ip->goal = bmap(ip, bn-1) + 1;
+  for(; n > 0; n--, bn++){
+    if(bmapw(ip, bn, &fresh) == 0)
+      break;
+  }
+  iupdate(ip);
+  return n > 0 ? -1 : 0;
+}
+
+// The name cache.
+//
+// namex() looks each path element up in the name cache before
+// it reads the directory. An entry maps (dev, directory inum,
+// name) to the inum the name has in that directory, or to 0 if
+// the directory has no such name, and records the type of the
+// inode and, for a symbolic link, its target, so that a walk
+// through cached names neither locks nor reads any inode.
+//
+// Entries are hashed into NDHASH chains; a miss recycles the
+// least recently used entry. dirlink() and unlink drop the
+// entry of the name they change, and iput() every entry in or
+// for an inode it frees. Each drop bumps dcache.seq, so a
+// lookup that read the directory while a name changed does
+// not cache what it found.
+//
+// The cache hands out inodes with iget() under dcache.lock,
+// so an unlink cannot free the inode of an entry found in the
+// cache before the finder holds a reference to it.
+//
+// namefast() walks a whole path through the cache without
+// dcache.lock, like a seqlock reader: dcache.wseq is odd while
+// an entry changes, and the walk only counts if wseq was even
+// and the same before and after it. Such a walk cannot refresh
+// the LRU list, so it sets the entry's used bit instead, and a
+// recycle gives a used entry a second chance.
+
+#define NDHASH 127
+
+struct dentry {
+  uint dev;              // 0 if unused
+  uint dir;              // inum of the directory
+  char name[DIRSIZ];
+  uint inum;             // 0 if dir has no such name
+  short type;            // type of inode inum
+  int used;              // found by namefast() since last recycle
+  char link[MAXPATH];    // target of a symbolic link
+  struct dentry *hnext;  // hash chain
+  struct dentry *prev;   // LRU list, most recent first
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *bucket[NDHASH];
+  struct dentry head;    // LRU list
+  uint seq;              // bumped by each drop
+  uint wseq;             // odd while an entry changes
+  uint hit;
+  uint miss;
+  uint fast[NCPU];       // walks done by namefast()
+  uint retry[NCPU];      // namefast() walks that fell back
+} dcache;
+
+static void
+dinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Return the entry for name in directory dir, or 0.
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.bucket[dhash(dev, dir, name)]; d; d = d->hnext){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Move d to the front of the LRU list, or with last set,
+// to the back, where it is recycled first.
+// Caller must hold dcache.lock.
+static void
+dmove(struct dentry *d, int last)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  if(last){
+    d->next = &dcache.head;
+    d->prev = dcache.head.prev;
+  } else {
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+  }
+  d->next->prev = d;
+  d->prev->next = d;
+}
+
+// Drop d from the cache.
+// Caller must hold dcache.lock.
+static void
+ddrop(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.bucket[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dev = 0;
+  dmove(d, 1);
+}
+
+// Start and end a change to the entries that namefast()
+// may see. Caller must hold dcache.lock.
+static void
+dwbegin(void)
+{
+  dcache.wseq++;
+  __sync_synchronize();
+}
+
+static void
+dwend(void)
+{
+  __sync_synchronize();
+  dcache.wseq++;
+}
+
+// Start and validate a walk through the cache without
+// dcache.lock; see namefast().
+static uint
+dreadbegin(void)
+{
+  uint s;
+
+  s = *(volatile uint*)&dcache.wseq;
+  __sync_synchronize();
+  return s;
+}
+
+static int
+dreadretry(uint s)
+{
+  __sync_synchronize();
+  return (s & 1) || *(volatile uint*)&dcache.wseq != s;
+}
+
+// Like dlookup() for directory dir, but without dcache.lock,
+// and copying out the inum rather than taking a reference.
+// What it sets is only right if dreadretry() then says so.
+static int
+dfast(uint dev, uint dir, char *name, uint *inum, short *type, char *target)
+{
+  struct dentry *d;
+  int n;
+
+  // a chain that changes under us may lead anywhere in
+  // dcache.dentry, even round in a circle.
+  d = dcache.bucket[dhash(dev, dir, name)];
+  for(n = 0; d && n < NDENTRY; d = d->hnext, n++){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0){
+      d->used = 1;
+      *inum = d->inum;
+      *type = d->type;
+      if(*type == T_SYMLINK){
+        memmove(target, d->link, MAXPATH);
+        target[MAXPATH-1] = '\0';
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Look name up in directory dp in the cache.
+// Returns 0 on a miss. On a hit, returns 1 and sets *ipp to
+// the inode, referenced but unlocked, or to 0 if dp has no
+// such name, *type to its type and, for a symbolic link,
+// target to its target.
+static int
+dlookup(struct inode *dp, char *name, struct inode **ipp, short *type, char *target)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    dcache.miss++;
+    release(&dcache.lock);
+    return 0;
+  }
+  dcache.hit++;
+  dmove(d, 0);
+  *ipp = 0;
+  if(d->inum)
+    *ipp = iget(d->dev, d->inum);
+  *type = d->type;
+  if(d->type == T_SYMLINK)
+    memmove(target, d->link, MAXPATH);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Return the drop count, for denter().
+static uint
+dseq(void)
+{
+  uint seq;
+
+  acquire(&dcache.lock);
+  seq = dcache.seq;
+  release(&dcache.lock);
+  return seq;
+}
+
+// Cache that name in directory dp is inode inum, of type
+// type, or is not there if inum is 0, unless an entry was
+// dropped since dseq() returned seq.
+static void
+denter(struct inode *dp, char *name, uint inum, short type, char *target, uint seq)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if(dcache.seq != seq){
+    release(&dcache.lock);
+    return;
+  }
+  dwbegin();
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    while((d = dcache.head.prev)->used){
+      d->used = 0;
+      dmove(d, 0);
+    }
+    if(d->dev)
+      ddrop(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dir, d->name);
+    d->hnext = dcache.bucket[h];
+    dcache.bucket[h] = d;
+  }
+  d->inum = inum;
+  d->type = type;
+  if(type == T_SYMLINK)
+    memmove(d->link, target, MAXPATH);
+  dmove(d, 0);
+  dwend();
+  release(&dcache.lock);
+}
+
+// Drop the entry for name in directory dp, which is
+// about to change.
+void
+dinval(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  dcache.seq++;
+  dwbegin();
+  if((d = dfind(dp->dev, dp->inum, name)) != 0)
+    ddrop(d);
+  dwend();
+  release(&dcache.lock);
+}
+
+// Drop every entry in directory inum, or for inode inum.
+static void
+dpurge(uint dev, uint inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  dcache.seq++;
+  dwbegin();
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    if(d->dev == dev && (d->dir == inum || d->inum == inum))
+      ddrop(d);
+  }
+  dwend();
+  release(&dcache.lock);
+}
+
+// Print name cache statistics, for lockstat().
+void
+dcachestat(void)
+{
+  uint fast = 0, retry = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    fast += dcache.fast[i];
+    retry += dcache.retry[i];
+  }
+  printf("dcache: %d entries #hit %d #miss %d\n", NDENTRY, dcache.hit, dcache.miss);
+  printf("dcache: #fast %d #retry %d\n", fast, retry);
+  printf("dcache: #acquire %d #spin %d\n", dcache.lock.n, dcache.lock.nts);
+}
+
 // Directories
 
 int
@@ -631,17 +1607,280 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Indexed directories.
+//
+// On an FS_DIRINDEX file system, a directory that outgrows its
+// first block gets an index. Block 0 then holds ".", "..", a
+// header entry and a hash table, all but the first two in
+// entries with inum 0 that readers such as ls skip. The other
+// blocks are leaves of ordinary entries. Entry j of the table
+// is the leaf of the names whose hash ends in the bits of j.
+// A full leaf is split in two on one more bit of the hash,
+// doubling the table if need be (extendible hashing).
+// A leaf that stays full, because the table cannot grow or
+// because its names agree in all the bits the table can use,
+// makes the directory fall back to linear search, past block 0.
+// The caller of each of these must hold dp->lock.
+
+#define DXHDR    2   // entry of the header in block 0
+#define DXTAB    3   // first entry of the table in block 0
+#define DXPERENT 7   // table entries in each dirent
+#define DXDEPTH  8   // the table has at most 1<<DXDEPTH entries
+#define DXMAGIC  "dxhash"  // in the header, after an empty name
+#define NDIRENT  (BSIZE / sizeof(struct dirent))
+
+// Return the FNV-1a hash of name.
+static uint
+dxhash(char *name)
+{
+  uint h = 2166136261U;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
+
+// The header entry of block 0 b.
+static struct dirent*
+dxhdr(uchar *b)
+{
+  return (struct dirent*)b + DXHDR;
+}
+
+// The number of bits of the hash the table of block 0 b uses.
+#define DXBITS(b) (dxhdr(b)->name[sizeof(DXMAGIC)])
+
+// Whether the directory of block 0 b has fallen back to
+// linear search.
+#define DXLINEAR(b) (dxhdr(b)->name[sizeof(DXMAGIC)+1])
+
+// Entry j of the table in block 0 b: the file block of a leaf.
+static ushort*
+dxtab(uchar *b, int j)
+{
+  return (ushort*)((struct dirent*)b)[DXTAB + j/DXPERENT].name + j%DXPERENT;
+}
+
+// If dp is an indexed directory, set *fbn to the leaf for
+// name and return 1, or return -1 if it has fallen back to
+// linear search. Otherwise return 0.
+static int
+dxfind(struct inode *dp, char *name, uint *fbn)
+{
+  struct buf *bp;
+  struct dirent *hdr;
+  int r = 0;
+
+  if((sb.flags & FS_DIRINDEX) == 0 || dp->size <= BSIZE)
+    return 0;
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    return 0;  // in block 0, found by a linear search
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  hdr = dxhdr(bp->data);
+  if(hdr->inum == 0 && hdr->name[0] == 0 &&
+     memcmp(hdr->name+1, DXMAGIC, sizeof(DXMAGIC)-1) == 0){
+    *fbn = *dxtab(bp->data, dxhash(name) & ((1 << DXBITS(bp->data)) - 1));
+    r = DXLINEAR(bp->data) ? -1 : 1;
+  }
+  brelse(bp);
+  return r;
+}
+
+// Look for name in leaf fbn of dp.
+// Returns its inum, and sets *poff, or returns 0.
+static uint
+dxscan(struct inode *dp, uint fbn, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint inum = 0;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, fbn));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < NDIRENT; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      if(poff)
+        *poff = fbn*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Add a leaf block at the end of dp, and return its file block,
+// or 0 if dp cannot grow.
+static uint
+dxnewleaf(struct inode *dp)
+{
+  uint fbn = dp->size / BSIZE;
+
+  if(bmap(dp, fbn) == 0)  // zeroed: all entries free
+    return 0;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return fbn;
+}
+
+// Split the full leaf fbn of dp in two.
+// Returns -1 if the table cannot grow any more, or dp cannot
+// have another leaf.
+static int
+dxsplit(struct inode *dp, uint fbn)
+{
+  struct buf *bp, *lb, *nb;
+  struct dirent *de, *nde;
+  uint nfbn;
+  int i, j, k, n, c, bits, lbits;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  bits = DXBITS(bp->data);
+  n = 1 << bits;
+
+  // 1 << (bits - lbits) table entries share a leaf whose
+  // names agree in their lowest lbits bits.
+  for(c = 0, j = 0; j < n; j++){
+    if(*dxtab(bp->data, j) == fbn)
+      c++;
+  }
+  for(lbits = bits; c > 1; c >>= 1)
+    lbits--;
+  if((lbits == bits && bits == DXDEPTH) || (nfbn = dxnewleaf(dp)) == 0){
+    brelse(bp);
+    return -1;
+  }
+  if(lbits == bits){
+    for(j = 0; j < n; j++)
+      *dxtab(bp->data, j + n) = *dxtab(bp->data, j);
+    DXBITS(bp->data) = ++bits;
+    n <<= 1;
+  }
+
+  for(j = 0; j < n; j++){
+    if(*dxtab(bp->data, j) == fbn && (j >> lbits) & 1)
+      *dxtab(bp->data, j) = nfbn;
+  }
+  log_write(bp);
+  brelse(bp);
+
+  // move the names with bit lbits set to the new leaf.
+  lb = bread(dp->dev, bmap(dp, fbn));
+  nb = bread(dp->dev, bmap(dp, nfbn));
+  de = (struct dirent*)lb->data;
+  nde = (struct dirent*)nb->data;
+  for(i = 0, k = 0; i < NDIRENT; i++){
+    if(de[i].inum != 0 && (dxhash(de[i].name) >> lbits) & 1){
+      nde[k++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(lb);
+  log_write(nb);
+  brelse(nb);
+  brelse(lb);
+  return 0;
+}
+
+// Add the entry (name, inum) to the indexed directory dp.
+// Splits the leaf at most once, so that an operation that adds
+// a name writes a bounded number of blocks. Returns -1 if the
+// leaf is still full; dp then uses linear search from now on.
+static int
+dxinsert(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint fbn;
+  int i, split;
+
+  for(split = 0; ; split = 1){
+    if(dxfind(dp, name, &fbn) != 1)
+      panic("dxinsert");
+    bp = bread(dp->dev, bmap(dp, fbn));
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < NDIRENT; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    brelse(bp);
+    if(split || dxsplit(dp, fbn) < 0)
+      break;
+  }
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  DXLINEAR(bp->data) = 1;
+  log_write(bp);
+  brelse(bp);
+  return -1;
+}
+
+// Give dp, a directory of one full block, an index: keep "."
+// and "..", and move the other entries to a leaf.
+// Returns -1, leaving dp as it was, if it cannot.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirent *de, *hdr;
+  char *old;
+  int i;
+
+  if((old = kalloc()) == 0)
+    return -1;
+  bp = bread(dp->dev, bmap(dp, 0));
+  de = (struct dirent*)bp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0 ||
+     dxnewleaf(dp) == 0){
+    brelse(bp);
+    kfree(old);
+    return -1;
+  }
+  memmove(old, bp->data, BSIZE);
+  memset(&de[DXHDR], 0, BSIZE - DXHDR*sizeof(*de));
+  hdr = dxhdr(bp->data);
+  memmove(hdr->name+1, DXMAGIC, sizeof(DXMAGIC)-1);
+  DXBITS(bp->data) = 0;
+  *dxtab(bp->data, 0) = 1;
+  log_write(bp);
+  brelse(bp);
+
+  // the empty leaf has room for all of the old block.
+  de = (struct dirent*)old;
+  for(i = DXHDR; i < NDIRENT; i++){
+    if(de[i].inum != 0 && dxinsert(dp, de[i].name, de[i].inum) < 0)
+      panic("dxconvert: leaf full");
+  }
+  kfree(old);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, fbn;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  // in an indexed directory, only name's leaf can hold it.
+  if(dxfind(dp, name, &fbn) > 0){
+    if((inum = dxscan(dp, fbn, name, poff)) == 0)
+      return 0;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -663,7 +1902,8 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, dx;
+  uint fbn;
   struct dirent de;
   struct inode *ip;
 
@@ -672,19 +1912,30 @@ dirlink(struct inode *dp, char *name, uint inum)
     iput(ip);
     return -1;
   }
+  dinval(dp, name);
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  if((dx = dxfind(dp, name, &fbn)) > 0 && dxinsert(dp, name, inum) == 0)
+    return 0;
+
+  // Look for an empty dirent, past the index of an indexed
+  // directory.
+  for(off = dx ? BSIZE : 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
       break;
   }
 
+  // a directory that outgrows its first block gets an index.
+  if(off == dp->size && off == BSIZE && (sb.flags & FS_DIRINDEX)){
+    if(dxconvert(dp) == 0)
+      return dxinsert(dp, name, inum);
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+    return -1;
 
   return 0;
 }
@@ -728,6 +1979,133 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Look up name in directory dp, which must not be locked,
+// through the name cache. Returns the inode, referenced but
+// unlocked, and sets *type to its type and, for a symbolic
+// link, target to its target. Returns 0 if dp is not a
+// directory or has no such name.
+static struct inode*
+dirwalk(struct inode *dp, char *name, short *type, char *target)
+{
+  struct inode *ip;
+  uint seq;
+
+  if(dlookup(dp, name, &ip, type, target))
+    return ip;
+
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlock(dp);
+    return 0;
+  }
+  seq = dseq();
+  ip = dirlookup(dp, name, 0);
+  iunlock(dp);
+  if(ip == 0){
+    denter(dp, name, 0, 0, 0, seq);
+    return 0;
+  }
+
+  // lock ip only now that dp is unlocked: ip may be dp itself,
+  // or for "..", dp's parent.
+  ilock(ip);
+  *type = ip->type;
+  if(ip->type == T_SYMLINK && readi(ip, 0, (uint64)target, 0, MAXPATH) != MAXPATH){
+    iunlockput(ip);
+    return 0;
+  }
+  iunlock(ip);
+  denter(dp, name, ip->inum, *type, target, seq);
+  return ip;
+}
+
+// Look up a path like namex(), but only through the name
+// cache, taking no lock until the end, when it takes a
+// reference to the inode it found. Returns 1 and sets *ipp,
+// to 0 if there is no such file, if the walk went through
+// cached names that did not change meanwhile; otherwise 0, to
+// have namex() walk the directories.
+static int
+namefast(char *path, int nameiparent, char *name, int nofollow, struct inode **ipp)
+{
+  char buf[MAXPATH], target[MAXPATH];
+  struct inode *ip;
+  uint s, dev, inum, next;
+  short type, ntype;
+  int depth, found;
+
+  s = dreadbegin();
+  if(s & 1)
+    goto retry;
+
+  safestrcpy(buf, path, MAXPATH);
+  path = buf;
+  if(*path == '/'){
+    dev = ROOTDEV;
+    inum = ROOTINO;
+  } else {
+    dev = myproc()->cwd->dev;
+    inum = myproc()->cwd->inum;
+  }
+  type = T_DIR;
+  found = 0;
+  depth = 0;
+
+  while((path = skipelem(path, name)) != 0){
+    if(type != T_DIR)
+      goto done;
+    if(nameiparent && *path == '\0'){
+      found = 1;
+      goto done;
+    }
+    if(!dfast(dev, inum, name, &next, &ntype, target))
+      goto retry;
+    if(next == 0 || ++depth > MAXPATH)
+      goto done;
+    if(ntype != T_SYMLINK || (nofollow && *path == '\0')){
+      inum = next;
+      type = ntype;
+      continue;
+    }
+
+    // expand the symbolic link as namex() does.
+    if(*path != '\0'){
+      if(strlen(target)+strlen(path)+1 >= MAXPATH)
+        goto done;
+      strcat(target, "/");
+      strcat(target, path);
+    }
+    safestrcpy(buf, target, MAXPATH);
+    path = buf;
+    if(*path == '/'){
+      dev = ROOTDEV;
+      inum = ROOTINO;
+    }
+  }
+  found = !nameiparent;
+
+done:
+  ip = 0;
+  if(found)
+    ip = iget(dev, inum);
+  if(dreadretry(s)){
+    if(ip)
+      iput(ip);
+    goto retry;
+  }
+  *ipp = ip;
+  push_off();
+  dcache.fast[cpuid()]++;
+  pop_off();
+  return 1;
+
+retry:
+  push_off();
+  dcache.retry[cpuid()]++;
+  pop_off();
+  return 0;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
@@ -741,6 +2119,10 @@ namex(char *path, int nameiparent, char *name, int nofollow)
   char target[MAXPATH];
   char *org = path;
   int depth = 0;
+  short type;
+
+  if(namefast(path, nameiparent, name, nofollow, &ip))
+    return ip;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -748,78 +2130,58 @@ namex(char *path, int nameiparent, char *name, int nofollow)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
-    if(ip->type != T_DIR){
-      iunlockput(ip);
-      return 0;
-    }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
+      ilock(ip);
+      if(ip->type != T_DIR){
+        iunlockput(ip);
+        return 0;
+      }
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    if((next = dirwalk(ip, name, &type, target)) == 0){
+      iput(ip);
       return 0;
     }
 
     depth++;
     if(depth > MAXPATH){
-      iunlockput(ip);
+      iput(next);
+      iput(ip);
       return 0;
     }
 
-    /* don't lock same ip twice */
-    if(ip == next){
-      iunlockput(ip);
+    /* with nofollow, the caller wants the inode of a final
+     * symbolic link itself
+     */
+    if(type != T_SYMLINK || (nofollow && *path == '\0')){
+      iput(ip);
       ip = next;
       continue;
     }
-
-    /* lock here to load the inode */
-    ilock(next);
-    if(next->type != T_SYMLINK){
-      iunlock(next);
-      iunlockput(ip);
-      ip = next;
-    } else {
-      if(nofollow && *path == '\0'){
-        /* caller wants the inode of symbolic link itself */
-        iunlock(next);
-        iunlockput(ip);
-        return next;
-      }
-
-      /* read the symbolic link */
-      if(readi(next, 0, (uint64)target, 0, MAXPATH) != MAXPATH){
-        iunlockput(next);
-        iunlockput(ip);
+    iput(next);
+
+    /* path expansion, concatenate the symbolic link and unwalked
+     * path
+     */
+    if(*path != '\0'){
+      if(strlen(target)+strlen(path)+1 >= MAXPATH){
+        iput(ip);
         return 0;
       }
-      iunlockput(next);
-
-      /* path expansion, concatenate the symbolic link and unwalked
-       * path
-       */
-      if(*path != '\0'){
-        if(strlen(target)+strlen(path)+1 >= MAXPATH){
-          iunlockput(ip);
-          return 0;
-        }
 
-        strcat(target, "/");
-        strcat(target, path);
-      }
+      strcat(target, "/");
+      strcat(target, path);
+    }
 
-      safestrcpy(org, target, MAXPATH);
-      path = org;
+    safestrcpy(org, target, MAXPATH);
+    path = org;
 
-      if(*path == '/'){
-        /* new path starts from root directory */
-        iunlockput(ip);
-        ip = iget(ROOTDEV, ROOTINO);
-      } else
-        iunlock(ip);
+    if(*path == '/'){
+      /* new path starts from root directory */
+      iput(ip);
+      ip = iget(ROOTDEV, ROOTINO);
     }
   }
   if(nameiparent){
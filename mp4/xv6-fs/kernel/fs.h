@@ -20,10 +20,20 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint logsize;      // Number of data blocks in each log region
+  uint flags;        // FS_ flags
+  uint orphan;       // First inode on the orphan list, or 0
 };
 
 #define FSMAGIC 0x10203040
 
+#define FS_EXTENT 0x1  // inodes map their blocks with extents
+#define FS_DIRINDEX 0x2  // big directories are indexed, see fs.c
+
+// Header blocks of a log region with n data blocks. The header
+// holds n, a sequence number and n block numbers.
+#define LOGHDRBLOCKS(n) (((n) + 2 + BSIZE/sizeof(uint) - 1) / (BSIZE/sizeof(uint)))
+
 // TODO: bigfile
 // You may need to modify these.
 #define NDIRECT 10
@@ -43,6 +53,23 @@ struct dinode {
   uint addrs[NDIRECT+3];   // Data block addresses
 };
 
+// With FS_EXTENT, the addrs[] of an inode hold NEXTENT
+// extents, used from the first, and addrs[EXTIDX]. An extent
+// maps len file blocks from lblk to the disk blocks from pblk.
+// A file with more extents keeps the rest in leaf blocks of
+// NEXTLEAF extents. addrs[EXTIDX] is an index block of up to
+// NEXTLEAF extents, one per leaf: pblk is the leaf, lblk its
+// first file block and len the number of extents in it.
+struct extent {
+  uint lblk;            // first file block
+  uint pblk;            // first disk block
+  uint len;             // number of blocks, 0 if unused
+};
+
+#define NEXTENT  4
+#define EXTIDX   (NDIRECT+2)
+#define NEXTLEAF (BSIZE / sizeof(struct extent))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -1,6 +1,10 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list and lock, so kalloc() and
+// kfree() on different CPUs do not contend. A CPU whose list
+// runs dry steals a batch of pages from another CPU's list.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +13,8 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define NSTEAL 32  // max pages moved by one steal
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,15 +24,21 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  uint nsteal;  // pages stolen from other CPUs
+};
+
+struct kmem kmems[NCPU];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmems[i].lock, "kmem");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -43,10 +55,12 @@ freerange(void *pa_start, void *pa_end)
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page goes onto the current CPU's free list.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem *km;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
@@ -56,10 +70,51 @@ kfree(void *pa)
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmems[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  release(&km->lock);
+  pop_off();
+}
+
+// Move up to NSTEAL pages from another CPU's free list
+// onto CPU id's list and return one of them.
+// Only one kmem lock is held at a time, so two CPUs
+// stealing from each other cannot deadlock.
+// Interrupts must be disabled.
+static struct run*
+ksteal(int id)
+{
+  struct run *r, *tail;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    struct kmem *victim = &kmems[(id + i) % NCPU];
+
+    acquire(&victim->lock);
+    r = victim->freelist;
+    tail = r;
+    for(n = 1; tail && tail->next && n < NSTEAL; n++)
+      tail = tail->next;
+    if(tail){
+      victim->freelist = tail->next;
+      tail->next = 0;
+    }
+    release(&victim->lock);
+
+    if(r == 0)
+      continue;
+
+    acquire(&kmems[id].lock);
+    tail->next = kmems[id].freelist;
+    kmems[id].freelist = r->next;
+    kmems[id].nsteal += n;
+    release(&kmems[id].lock);
+    return r;
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +124,54 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  push_off();
+  id = cpuid();
+  km = &kmems[id];
+  acquire(&km->lock);
+  r = km->freelist;
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    km->freelist = r->next;
+  release(&km->lock);
+
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Return the number of free pages, on all CPUs.
+int
+kfreepages(void)
+{
+  struct run *r;
+  int i, n = 0;
+
+  for(i = 0; i < NCPU; i++){
+    acquire(&kmems[i].lock);
+    for(r = kmems[i].freelist; r; r = r->next)
+      n++;
+    release(&kmems[i].lock);
+  }
+  return n;
+}
+
+// Print allocator lock statistics, for lockstat().
+void
+kallocstat(void)
+{
+  uint n = 0, nts = 0, nsteal = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    n += kmems[i].lock.n;
+    nts += kmems[i].lock.nts;
+    nsteal += kmems[i].nsteal;
+  }
+  printf("kmem: #acquire %d #spin %d #steal %d\n", n, nts, nsteal);
+}
@@ -20,141 +20,513 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves MAXOPBLOCKS blocks of the log;
+// begin_opn() lets an operation such as a big write()
+// reserve more, up to log_maxop().
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// It is divided into NLOGREGION regions, used in turn by
+// successive transactions. mkfs chooses the number of data
+// blocks in a region and records it in the superblock.
+// The on-disk format of a region:
+//   header blocks, LOGHDRBLOCKS(logsize) of them, containing
+//     the block count, a sequence number and
+//     block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// A commit copies the transaction's blocks into log buffers
+// before anything else; from then on new FS system calls can
+// start a new transaction, which a later commit writes to the
+// next region while this one is still being written and
+// installed. Transactions are installed in sequence order, and
+// recovery replays the committed regions in that order too.
+//
+// The log buffers of a region are its own, not part of the
+// buffer cache, since only recovery ever reads the log. The
+// same buffers first go to the log and then, relabelled with
+// the home block numbers, to the home locations.
+//
+// Ordered mode: with ORDERED set, blocks of file data that
+// log_write_data() is given are not logged. The commit writes
+// them to their home locations, after earlier transactions are
+// installed and before its own header, so a committed inode
+// never points at stale data. A block that the transaction
+// freed is logged after all, since writing it in place would
+// clobber its old owner if the transaction did not commit.
+// The commit copies the data blocks too, as it does the logged
+// ones, since the next transaction may free and reuse one of
+// them before this commit writes it.
+//
+// Group commit: with COMMITDELAY > 0, the end_op() of the last
+// outstanding operation does not commit, unless the transaction
+// already fills half the log. Instead the log flusher process
+// commits COMMITDELAY ticks later, so that the operations of
+// that interval share one commit. log_flush() (fsync()) commits
+// without waiting for the flusher.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
+// The header spans as many blocks as its block #s need; the
+// count, in the first block, is written last.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;  // commit order, for recovery
+  int block[MAXLOGSIZE];
+};
+
+#define MAXLOGHDR LOGHDRBLOCKS(MAXLOGSIZE)
+
+// A transaction being committed in one log region.
+struct logregion {
+  struct logheader lh;
+  struct buf hbuf[MAXLOGHDR];    // its header blocks
+  struct buf lbuf[MAXLOGSIZE];   // copies of its blocks
+  struct buf *cbuf[MAXLOGSIZE];  // its blocks in the cache, pinned
+  struct buf *wv[MAXLOGHDR+MAXLOGSIZE]; // bufs of one bwrite_start()
+  int ndata;                     // ordered-mode data blocks
+  int data[MAXLOGSIZE];
+  struct buf dbuf[MAXLOGSIZE];   // copies of them
+  struct buf *dcbuf[MAXLOGSIZE]; // them in the cache, pinned
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // blocks in each region, including the header
+  int nhdr;        // header blocks in each region
+  int cap;         // max data blocks in a transaction
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by them.
+  int committing;  // copying lh into a region, please wait.
+  int force;       // commit as soon as outstanding reaches 0.
+  int crash;       // stop dead after the next commit point.
+  int ninflight;   // regions in use by commits.
+  uint seq;        // sequence number of the next commit.
+  uint ncommit;    // sequence number of the next commit to finish.
   int dev;
   struct logheader lh;
+  int ndata;       // ordered-mode data blocks of the transaction.
+  int data[MAXLOGSIZE];
+  int nfreed;      // blocks it freed; NFREED+1 if too many to list.
+  int freed[NFREED];
+  struct logregion region[NLOGREGION];
 };
 struct log log;
 
+// does the transaction being built have no blocks?
+#define LOGEMPTY() (log.lh.n == 0 && log.ndata == 0)
+
+// the k'th header block and the i'th log block of region r
+#define HDRBLOCK(r, k) (log.start + ((r) - log.region) * log.size + (k))
+#define LOGBLOCK(r, i) (HDRBLOCK(r, log.nhdr) + (i))
+
 static void recover_from_log(void);
-static void commit();
+static void log_flusher(void);
+
+// Give the n bufs in bv data of their own, BSIZE bytes each.
+static void
+allocbufs(struct buf *bv, int n, char *name)
+{
+  char *pg = 0;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (i % (PGSIZE/BSIZE) == 0 && (pg = kalloc()) == 0)
+      panic("initlog: kalloc");
+    bv[i].data = (uchar*)pg + (i % (PGSIZE/BSIZE)) * BSIZE;
+    initsleeplock(&bv[i].lock, name);
+  }
+}
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  struct logregion *r;
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.nhdr = LOGHDRBLOCKS(sb->logsize);
+  if (log.nhdr > MAXLOGHDR)
+    panic("initlog: log too big");
+  log.size = log.nhdr + sb->logsize;
   log.dev = dev;
+  if (sb->nlog != NLOGREGION * log.size)
+    panic("initlog: bad log size");
+
+  // every block of a transaction, logged or ordered-mode data,
+  // stays pinned in the cache until it is installed. The one
+  // being built and one in each region may pin up to 2*cap
+  // blocks each; leave at least cap more for readers.
+  log.cap = sb->logsize;
+  if (log.cap > MAXLOGSIZE)
+    log.cap = MAXLOGSIZE;
+  if (log.cap > bcachesize() / (2*(NLOGREGION+1)+1))
+    log.cap = bcachesize() / (2*(NLOGREGION+1)+1);
+  if (log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
+
+  for (r = log.region; r < log.region+NLOGREGION; r++) {
+    allocbufs(r->hbuf, log.nhdr, "loghdr");
+    allocbufs(r->lbuf, log.cap, "logbuf");
+    allocbufs(r->dbuf, log.cap, "logdata");
+  }
   recover_from_log();
+  if(COMMITDELAY > 0)
+    kproc(log_flusher, "logflush");
+}
+
+// Add b to r->wv[0..n-1], which is in block order, so that
+// runs of adjacent blocks go to the disk as single requests.
+static void
+sortbuf(struct logregion *r, int n, struct buf *b)
+{
+  int i;
+
+  for (i = n; i > 0 && r->wv[i-1]->blockno > b->blockno; i--)
+    r->wv[i] = r->wv[i-1];
+  r->wv[i] = b;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from the log buffers to their home
+// location, all in one batch, and unpin them in the cache.
+// The cache may have newer data from a later transaction by
+// now, so the writes come from the log buffers.
 static void
-install_trans(int recovering)
+install_trans(struct logregion *r)
 {
+  struct buf *b;
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < r->lh.n; tail++) {
+    b = &r->lbuf[tail];
+    acquiresleep(&b->lock);
+    b->blockno = r->lh.block[tail];
+    sortbuf(r, tail, b);
+  }
+  bwrite_start(r->wv, r->lh.n);  // write dst to disk
+  for (tail = 0; tail < r->lh.n; tail++) {
+    bwrite_wait(r->wv[tail]);
+    releasesleep(&r->wv[tail]->lock);
+    bunpin(r->cbuf[tail]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Copy the blocks of a transaction that committed before a
+// crash from the on-disk log to their home location, and
+// into the cache.
 static void
-read_head(void)
+replay_trans(struct logregion *r)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  struct buf *lbuf, *b;
+  int tail;
+
+  for (tail = 0; tail < r->lh.n; tail++)
+    breadahead(log.dev, LOGBLOCK(r, tail));
+  for (tail = 0; tail < r->lh.n; tail++) {
+    lbuf = bread(log.dev, LOGBLOCK(r, tail)); // read log block
+    b = bread(log.dev, r->lh.block[tail]); // read dst
+    memmove(b->data, lbuf->data, BSIZE);  // copy block to dst
+    brelse(lbuf);
+    sortbuf(r, tail, b);
   }
+  bwrite_start(r->wv, r->lh.n);  // write dst to disk
+  for (tail = 0; tail < r->lh.n; tail++) {
+    bwrite_wait(r->wv[tail]);
+    brelse(r->wv[tail]);
+  }
+}
+
+// Bytes of r's header in use, and how many of them
+// are in header block k.
+#define HDRBYTES(r)     (sizeof(int) * (2 + (r)->lh.n))
+#define HDRPART(r, k)   (HDRBYTES(r) - (k)*BSIZE < BSIZE ? HDRBYTES(r) - (k)*BSIZE : BSIZE)
+
+// Read the header of region r from disk into r->lh.
+static void
+read_head(struct logregion *r)
+{
+  struct buf *buf = bread(log.dev, HDRBLOCK(r, 0));
+  int k;
+
+  memmove(&r->lh, buf->data, BSIZE);
   brelse(buf);
+  if (r->lh.n < 0 || r->lh.n > MAXLOGSIZE || r->lh.n > log.size - log.nhdr)
+    panic("read_head");
+  for (k = 1; k*BSIZE < HDRBYTES(r); k++) {
+    buf = bread(log.dev, HDRBLOCK(r, k));
+    memmove((char*)&r->lh + k*BSIZE, buf->data, HDRPART(r, k));
+    brelse(buf);
+  }
 }
 
-// Write in-memory log header to disk.
+// Write the first header block of region r to disk.
 // This is the true point at which the
-// current transaction commits.
+// region's transaction commits; write_log()
+// has written the rest of the header.
 static void
-write_head(void)
+write_head(struct logregion *r)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct buf *buf = &r->hbuf[0];
+
+  acquiresleep(&buf->lock);
+  buf->dev = log.dev;
+  buf->blockno = HDRBLOCK(r, 0);
+  memmove(buf->data, &r->lh, HDRPART(r, 0));
   bwrite(buf);
-  brelse(buf);
+  releasesleep(&buf->lock);
 }
 
+// Replay the committed regions, oldest first, then clear them.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
+  struct logregion *r, *next;
+
+  log.seq = 0;
+  for (r = log.region; r < log.region+NLOGREGION; r++) {
+    read_head(r);
+    if (r->lh.seq >= log.seq)
+      log.seq = r->lh.seq + 1;
+  }
+
+  for(;;){
+    next = 0;
+    for (r = log.region; r < log.region+NLOGREGION; r++) {
+      if (r->lh.n > 0 && (next == 0 || r->lh.seq < next->lh.seq))
+        next = r;
+    }
+    if (next == 0)
+      break;
+    replay_trans(next); // copy from log to disk
+    next->lh.n = 0;
+    write_head(next); // clear the region
+  }
+  log.ncommit = log.seq;
+}
+
+// Copy the blocks of r's transaction, logged and ordered-mode
+// data, from the cache to its own buffers, so that later
+// transactions may change the cache.
+static void
+copy_log(struct logregion *r)
+{
+  int tail;
+
+  for (tail = 0; tail < r->lh.n; tail++) {
+    r->cbuf[tail] = bread(log.dev, r->lh.block[tail]); // cache block
+    memmove(r->lbuf[tail].data, r->cbuf[tail]->data, BSIZE);
+    brelse(r->cbuf[tail]);  // still pinned
+  }
+  for (tail = 0; tail < r->ndata; tail++) {
+    r->dcbuf[tail] = bread(log.dev, r->data[tail]);
+    memmove(r->dbuf[tail].data, r->dcbuf[tail]->data, BSIZE);
+    brelse(r->dcbuf[tail]);  // still pinned
+  }
+}
+
+// Write r's log buffers, and the header blocks after the
+// first, to disk. They are adjacent, so they go to the disk
+// in as few requests as the driver allows.
+static void
+write_log(struct logregion *r)
+{
+  struct buf *buf;
+  int k, n = 0, tail;
+
+  for (k = 1; k*BSIZE < HDRBYTES(r); k++) {
+    buf = &r->hbuf[k];
+    acquiresleep(&buf->lock);
+    buf->dev = log.dev;
+    buf->blockno = HDRBLOCK(r, k);
+    memmove(buf->data, (char*)&r->lh + k*BSIZE, HDRPART(r, k));
+    r->wv[n++] = buf;
+  }
+  for (tail = 0; tail < r->lh.n; tail++) {
+    buf = &r->lbuf[tail];
+    acquiresleep(&buf->lock);
+    buf->dev = log.dev;
+    buf->blockno = LOGBLOCK(r, tail);
+    r->wv[n++] = buf;
+  }
+  bwrite_start(r->wv, n);
+  for (k = 0; k < n; k++) {
+    bwrite_wait(r->wv[k]);
+    releasesleep(&r->wv[k]->lock);
+  }
+}
+
+// Write the copies of r's ordered-mode data blocks to their
+// home locations, and unpin the blocks in the cache, which
+// have been kept there so that no one reads the old contents
+// from disk meanwhile.
+static void
+write_data(struct logregion *r)
+{
+  struct buf *b;
+  int tail;
+
+  for (tail = 0; tail < r->ndata; tail++) {
+    b = &r->dbuf[tail];
+    acquiresleep(&b->lock);
+    b->dev = log.dev;
+    b->blockno = r->data[tail];
+    sortbuf(r, tail, b);
+  }
+  bwrite_start(r->wv, r->ndata);
+  for (tail = 0; tail < r->ndata; tail++) {
+    bwrite_wait(r->wv[tail]);
+    releasesleep(&r->wv[tail]->lock);
+    bunpin(r->dcbuf[tail]);
+  }
+}
+
+// Commit the current transaction, which has no outstanding
+// operations, and wake up anyone waiting for the commit.
+// Returns without committing if that stops being true while
+// waiting for a free region.
+// Called with log.lock held; returns with it held.
+static void
+commit_locked(void)
+{
+  struct logregion *r;
+  uint seq;
+  int tail;
+
+  while(log.ninflight == NLOGREGION)
+    sleep(&log, &log.lock);
+  if(log.committing || log.outstanding > 0 || LOGEMPTY())
+    return;
+
+  seq = log.seq++;
+  r = &log.region[seq % NLOGREGION];
+  r->lh.n = log.lh.n;
+  r->lh.seq = seq;
+  for (tail = 0; tail < log.lh.n; tail++)
+    r->lh.block[tail] = log.lh.block[tail];
+  r->ndata = log.ndata;
+  for (tail = 0; tail < log.ndata; tail++)
+    r->data[tail] = log.data[tail];
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.ndata = 0;
+  log.nfreed = 0;
+  log.committing = 1;
+  log.force = 0;
+  log.ninflight++;
+  release(&log.lock);
+
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  copy_log(r);
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);  // let begin_op() start the next transaction
+  release(&log.lock);
+
+  write_log(r);     // Write modified blocks from cache to log
+
+  acquire(&log.lock);
+  while(log.ncommit != seq)  // after earlier transactions are installed,
+    sleep(&log, &log.lock);
+  release(&log.lock);
+
+  write_data(r);    // write data blocks in place,
+  write_head(r);    // Write header to disk -- the real commit
+  if(log.crash)
+    panic("log: crash test");  // committed, but not installed
+
+  install_trans(r); // Now install writes to home locations
+  r->lh.n = 0;
+  write_head(r);    // Erase the transaction from the log
+
+  acquire(&log.lock);
+  log.ncommit++;
+  log.ninflight--;
+  wakeup(&log);
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Make the next commit stop the kernel right after its commit
+// point, for crash-recovery tests.
+void
+log_crash(void)
+{
+  acquire(&log.lock);
+  log.crash = 1;
+  release(&log.lock);
+}
+
+// The most log blocks one operation may reserve.
+int
+log_maxop(void)
+{
+  return log.cap/2 > MAXOPBLOCKS ? log.cap/2 : MAXOPBLOCKS;
+}
+
+// called at the start of an FS system call that
+// may write up to n blocks, n <= log_maxop().
+void
+begin_opn(int n)
 {
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+    } else if(log.lh.n + log.reserved + n > log.cap ||
+              log.ndata + log.reserved + n > log.cap){
+      // this op might exhaust log space; wait for commit,
+      // or commit now if the flusher would have to.
+      if(log.outstanding == 0)
+        commit_locked();
+      else
+        sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
+// called at the end of an FS system call that began
+// with begin_opn(n).
 // commits if this was the last outstanding operation.
 void
-end_op(void)
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    if(COMMITDELAY == 0 || log.force || log.lh.n >= log.cap/2 || log.ndata >= log.cap/2)
+      do_commit = 1;
+    else
+      wakeup(&log.ncommit);  // leave it to the flusher
+  }
+  if(do_commit){
+    commit_locked();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,49 +534,67 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
-
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
 }
 
-// Copy modified blocks from cache to log.
-static void
-write_log(void)
+// Commit every operation that has already called end_op(),
+// for fsync().
+void
+log_flush(void)
 {
-  int tail;
+  uint target;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  acquire(&log.lock);
+  // begin_op() keeps new operations out of a commit that is
+  // copying its blocks, so ended operations are either in lh
+  // or in a commit with an earlier sequence number.
+  target = !LOGEMPTY() ? log.seq + 1 : log.seq;
+  while(log.ncommit < target){
+    if(log.seq == target){
+      // only in-flight commits left to wait for.
+      sleep(&log, &log.lock);
+    } else if(!log.committing && log.outstanding == 0){
+      commit_locked();
+    } else {
+      log.force = 1;
+      sleep(&log, &log.lock);
+    }
   }
+  release(&log.lock);
 }
 
+// Body of the log flusher process, which commits the
+// operations that end_op() left behind, after waiting
+// COMMITDELAY ticks for more to join them.
 static void
-commit()
+log_flusher(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  uint t0;
+
+  acquire(&log.lock);
+  for(;;){
+    while(LOGEMPTY() || log.outstanding > 0 || log.committing)
+      sleep(&log.ncommit, &log.lock);
+    release(&log.lock);
+
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < COMMITDELAY)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    if(log.committing || LOGEMPTY())
+      continue;
+    if(log.outstanding == 0)
+      commit_locked();
+    else
+      log.force = 1;  // the last end_op() commits
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit_locked() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +607,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -234,3 +624,74 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Like log_write(), for a block of file data.
+// In ordered mode the block is written in place by the
+// commit rather than logged, unless this transaction freed
+// it, or freed more blocks than it keeps track of.
+void
+log_write_data(struct buf *b)
+{
+  int i;
+
+  if(!ORDERED){
+    log_write(b);
+    return;
+  }
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_write_data outside of trans");
+  for (i = 0; i < log.nfreed && i < NFREED; i++) {
+    if (log.freed[i] == b->blockno)
+      break;
+  }
+  if (log.nfreed > NFREED || i < log.nfreed) {
+    release(&log.lock);
+    log_write(b);
+    return;
+  }
+
+  if (log.ndata >= log.cap)
+    panic("too big a transaction");
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == b->blockno)   // absorption
+      break;
+  }
+  if (i == log.ndata) {
+    bpin(b);
+    log.data[log.ndata++] = b->blockno;
+  }
+  release(&log.lock);
+}
+
+// Note that the current transaction freed block b,
+// so that log_write_data() does not write it in place.
+// If b was file data waiting to be written in place, it
+// is not written after all: whoever gets b next may have
+// put other data in its cache buffer by then.
+void
+log_free(uint b)
+{
+  struct buf *bp;
+  int i, dropped = 0;
+
+  acquire(&log.lock);
+  if (log.nfreed < NFREED)
+    log.freed[log.nfreed++] = b;
+  else
+    log.nfreed = NFREED+1;
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == b) {
+      log.data[i] = log.data[--log.ndata];
+      dropped = 1;
+      break;
+    }
+  }
+  release(&log.lock);
+
+  if (dropped) {
+    bp = bread(log.dev, b);  // pinned, so cached
+    bunpin(bp);
+    brelse(bp);
+  }
+}
@@ -3,12 +3,22 @@
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
+#define NDENTRY     256  // entries in the name cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define LOGSIZE      512  // data blocks in each log region, unless mkfs -l says otherwise
+#define MAXLOGSIZE   1024 // max data blocks in a transaction
+#define NLOGREGION   2   // log regions; one commits while the next fills
+#define NBUF         (MAXOPBLOCKS*3*(2*(NLOGREGION+1)+1))  // minimum size of disk block cache; a log's pins use 6/7 of it
+#ifndef COMMITDELAY
+#define COMMITDELAY  0   // ticks a group commit waits for more ops; 0: commit in end_op()
+#endif
+#define ORDERED      1   // write file data in place, logging only metadata
+#define NFREED       64  // freed blocks a transaction tracks for ordered mode
+#define MAXBUF       8192  // maximum size of disk block cache
+#define NREADAHEAD   16  // max blocks read ahead of a sequential reader
 // TODO: bigfile. You need 200000 FSSIZE to finish Large Files.
 #define FSSIZE       200000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
@@ -247,6 +247,37 @@ userinit(void)
   release(&p->lock);
 }
 
+// A kernel process's very first scheduling by scheduler()
+// will swtch to kprocstart.
+static void
+kprocstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kproc returned");
+}
+
+// Start a process that runs fn() in the kernel, for work that
+// must be able to sleep but belongs to no user process, such
+// as the log flusher. fn must never return.
+void
+kproc(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
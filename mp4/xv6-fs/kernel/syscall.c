@@ -105,6 +105,11 @@ extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_symlink(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_logcrash(void);
+extern uint64 sys_freeblocks(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -129,6 +134,11 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_symlink]   sys_symlink,
+[SYS_lockstat]  sys_lockstat,
+[SYS_fsync]   sys_fsync,
+[SYS_fallocate]  sys_fallocate,
+[SYS_logcrash]  sys_logcrash,
+[SYS_freeblocks]  sys_freeblocks,
 };
 
 void
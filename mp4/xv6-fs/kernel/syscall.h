@@ -20,4 +20,9 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
-#define SYS_symlink 22
\ No newline at end of file
+#define SYS_symlink 22
+#define SYS_lockstat 23
+#define SYS_fsync 24
+#define SYS_fallocate 25
+#define SYS_logcrash 26
+#define SYS_freeblocks 27
@@ -104,6 +104,49 @@ sys_close(void)
   return 0;
 }
 
+// Make the completed writes to fd durable. All files
+// share one log, so this commits every ended operation.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_flush();
+  return 0;
+}
+
+// Preallocate disk blocks for part of a file.
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0)
+    return -1;
+  if(off < 0 || len < 0)
+    return -1;
+  return filefallocate(f, off, len);
+}
+
+// Stop the kernel right after the next commit point,
+// for crash-recovery tests.
+uint64
+sys_logcrash(void)
+{
+  log_crash();
+  return 0;
+}
+
+// Return the number of free disk blocks.
+uint64
+sys_freeblocks(void)
+{
+  return bfreecount();
+}
+
 uint64
 sys_fstat(void)
 {
@@ -215,6 +258,7 @@ sys_unlink(void)
     goto bad;
   }
 
+  dinval(dp, name);
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
@@ -258,8 +302,10 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -268,19 +314,30 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto fail;
   }
 
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto fail;
+
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
   return ip;
+
+fail:
+  // no room for the name: free ip again.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
 }
 
 uint64
@@ -342,6 +399,9 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->seqoff = 0;
+    f->ra = 0;
+    f->ranext = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -95,3 +95,14 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// print lock contention counters of the
+// allocator, the buffer cache and the name cache to the console.
+uint64
+sys_lockstat(void)
+{
+  kallocstat();
+  bcachestat();
+  dcachestat();
+  return 0;
+}
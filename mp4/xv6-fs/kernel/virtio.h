@@ -45,7 +45,10 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 128
+
+// most blocks moved by one request, each in its own descriptor.
+#define NSEG 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -59,10 +59,12 @@ static struct disk {
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // status and done are indexed by first descriptor index
+  // of chain, b by the index of the buf's data descriptor.
   struct {
     struct buf *b;
     char status;
+    void (*done)(struct buf *); // called on completion, if set
   } info[NUM];
 
   // disk command headers.
@@ -184,12 +186,12 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a disk transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,27 +202,17 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// format the n+2 descriptors in idx for a transfer of the n
+// blocks in bv, which must be consecutive on the disk, and
+// hand them to the device.
+// caller must hold vdisk_lock.
+static void
+virtio_disk_start(struct buf **bv, int n, int write, int *idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  uint64 sector = bv[0]->blockno * (BSIZE / 512);
+  int i;
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -237,24 +229,30 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  // one data descriptor per block; the device treats them
+  // as one contiguous transfer.
+  for(i = 1; i <= n; i++){
+    struct buf *b = bv[i-1];
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+    disk.desc[idx[i]].addr = (uint64) b->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+    // record struct buf for virtio_disk_intr().
+    b->disk = 1;
+    disk.info[idx[i]].b = b;
+  }
+
+  disk.info[idx[0]].status = 0xff; // device writes 0 on success
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -267,18 +265,73 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// start reading or writing the n blocks in bv and return
+// without waiting. runs of consecutive block numbers, up to
+// NSEG blocks long, go to the device as a single request.
+// when the disk is done with a buf b, virtio_disk_intr()
+// calls done(b) if done is not 0; otherwise the caller must
+// virtio_disk_wait(b). done runs in interrupt context with
+// vdisk_lock held, so it must not sleep.
+// sleeps only if all the descriptors are in use.
+void
+virtio_disk_submitv(struct buf **bv, int n, int write, void (*done)(struct buf *))
+{
+  int idx[NSEG+2];
+  int i, k;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i += k){
+    // the spec's Section 5.2 says that legacy block operations use
+    // a descriptor for type/reserved/sector, then the data, then
+    // a descriptor for a 1-byte status result.
+    for(k = 1; i+k < n && k < NSEG; k++){
+      if(bv[i+k]->dev != bv[i]->dev || bv[i+k]->blockno != bv[i]->blockno + k)
+        break;
+    }
+
+    while(1){
+      if(alloc_descs(idx, k+2) == 0) {
+        break;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+
+    disk.info[idx[0]].done = done;
+    virtio_disk_start(bv+i, k, write, idx);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// start a read or write of b and return without waiting for it.
+void
+virtio_disk_submit(struct buf *b, int write, void (*done)(struct buf *))
+{
+  virtio_disk_submitv(&b, 1, write, done);
+}
 
+// wait for a virtio_disk_submit() of b without a done
+// function to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write, 0);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -304,9 +357,20 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    void (*done)(struct buf *) = disk.info[id].done;
+    disk.info[id].done = 0;
+
+    // each data descriptor records its buf.
+    for(int d = disk.desc[id].next; disk.desc[d].flags & VRING_DESC_F_NEXT; d = disk.desc[d].next){
+      struct buf *b = disk.info[d].b;
+      disk.info[d].b = 0;
+      b->disk = 0;   // disk is done with buf
+      if(done)
+        done(b);
+      else
+        wakeup(b);
+    }
+    free_chain(id);
 
     disk.used_idx += 1;
   }
@@ -15,14 +15,16 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 200  // default number of inodes
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int ninodes = NINODES;
+int ninodeblocks;
+int logsize = LOGSIZE; // Number of data blocks in each log region
+int nlog;     // Number of log blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -31,6 +33,8 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int extents;  // make an FS_EXTENT file system
+int dirindex; // make an FS_DIRINDEX file system
 
 
 void balloc(int);
@@ -40,6 +44,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint ebmap(struct dinode *din, uint fbn);
 
 // convert to intel byte order
 ushort
@@ -76,13 +81,37 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(;;){
+    if(argc > 2 && strcmp(argv[1], "-l") == 0){
+      logsize = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc > 2 && strcmp(argv[1], "-i") == 0){
+      ninodes = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc > 1 && strcmp(argv[1], "-e") == 0){
+      extents = 1;
+      argc--;
+      argv++;
+    } else if(argc > 1 && strcmp(argv[1], "-x") == 0){
+      dirindex = 1;
+      argc--;
+      argv++;
+    } else
+      break;
+  }
+  // an inum must fit in a dirent, and a transaction in the
+  // kernel's log header
+  if(argc < 2 || logsize < 1 || logsize > MAXLOGSIZE || ninodes < 2 || ninodes > 65536){
+    fprintf(stderr, "Usage: mkfs [-e] [-x] [-i ninodes] [-l logsize] fs.img files...\n");
     exit(1);
   }
+  ninodeblocks = ninodes / IPB + 1;
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(NEXTENT*sizeof(struct extent) <= EXTIDX*sizeof(uint));
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -91,17 +120,20 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
+  nlog = NLOGREGION * (LOGHDRBLOCKS(logsize) + logsize);
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
   sb.size = xint(FSSIZE);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.logsize = xint(logsize);
+  sb.flags = xint((extents ? FS_EXTENT : 0) | (dirindex ? FS_DIRINDEX : 0));
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -276,7 +308,9 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(extents){
+      x = ebmap(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
@@ -354,3 +388,28 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Return the block of extent inode din holding file block fbn,
+// allocating it if need be. Blocks are allocated in order, so
+// a file only needs more than one extent where its blocks are
+// interleaved with those of the root directory.
+uint
+ebmap(struct dinode *din, uint fbn)
+{
+  struct extent *e = (struct extent*)din->addrs;
+  int i;
+
+  for(i = 0; i < NEXTENT && xint(e[i].len) > 0; i++){
+    if(fbn >= xint(e[i].lblk) && fbn < xint(e[i].lblk) + xint(e[i].len))
+      return xint(e[i].pblk) + fbn - xint(e[i].lblk);
+  }
+  if(i > 0 && xint(e[i-1].pblk) + xint(e[i-1].len) == freeblock){
+    e[i-1].len = xint(xint(e[i-1].len) + 1);
+    return freeblock++;
+  }
+  assert(i < NEXTENT);
+  e[i].lblk = xint(fbn);
+  e[i].pblk = xint(freeblock);
+  e[i].len = xint(1);
+  return freeblock++;
+}
@@ -0,0 +1,103 @@
+// Parallel read benchmark for the buffer cache.
+// Each process re-reads its own small file, which stays
+// cached, so the processes only meet on the cache locks.
+// lockstat() before and after reports the hit rate and
+// the lock spins.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NCHILD  4
+#define NBLK    4     // blocks per file
+#define NROUND  500
+
+char buf[BSIZE];
+
+void
+createfile(char *name)
+{
+  int fd, i;
+
+  if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+    printf("bcachetest: cannot create %s\n", name);
+    exit(-1);
+  }
+  for(i = 0; i < NBLK; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bcachetest: write %s failed\n", name);
+      exit(-1);
+    }
+  }
+  close(fd);
+}
+
+void
+reader(char *name)
+{
+  int fd, i, j;
+
+  for(i = 0; i < NROUND; i++){
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("bcachetest: cannot open %s\n", name);
+      exit(-1);
+    }
+    for(j = 0; j < NBLK; j++){
+      if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'a' + j){
+        printf("bcachetest: read %s failed\n", name);
+        exit(-1);
+      }
+    }
+    close(fd);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[] = "bct0";
+  int i, n, t0, t1;
+
+  n = NCHILD;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > 10)
+    n = NCHILD;
+
+  for(i = 0; i < n; i++){
+    name[3] = '0' + i;
+    createfile(name);
+  }
+
+  printf("bcachetest: %d processes, %d reads of %d blocks\n", n, NROUND, NBLK);
+  lockstat();
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bcachetest: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      name[3] = '0' + i;
+      reader(name);
+    }
+  }
+  for(i = 0; i < n; i++)
+    wait(0);
+  t1 = uptime();
+
+  lockstat();
+  printf("bcachetest: %d ticks\n", t1 - t0);
+
+  for(i = 0; i < n; i++){
+    name[3] = '0' + i;
+    unlink(name);
+  }
+  exit(0);
+}
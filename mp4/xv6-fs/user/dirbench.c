@@ -0,0 +1,78 @@
+// Big-directory benchmark.
+// Creates 10000 empty files in one directory, stats each of
+// them, then deletes them, and reports the ticks each phase
+// takes. Each create and stat looks the name up first, so a
+// linear directory costs a scan of the whole directory per
+// file, and an indexed one (make DIRINDEX=1) a leaf block.
+// The file system needs the inodes: make NINODES=10100.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFILE  10000
+
+char name[] = "f00000";
+
+void
+setname(int i)
+{
+  int k;
+
+  for(k = 5; k > 0; k--, i /= 10)
+    name[k] = '0' + i % 10;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct stat st;
+  int fd, i, n, t0, t1, t2, t3;
+
+  n = NFILE;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > 99999)
+    n = NFILE;
+
+  if(mkdir("dirbench.d") < 0 || chdir("dirbench.d") < 0){
+    printf("dirbench: cannot make dirbench.d\n");
+    exit(-1);
+  }
+
+  printf("dirbench: %d files\n", n);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+      printf("dirbench: cannot create %s\n", name);
+      exit(-1);
+    }
+    close(fd);
+  }
+  t1 = uptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if(stat(name, &st) < 0 || st.type != T_FILE){
+      printf("dirbench: cannot stat %s\n", name);
+      exit(-1);
+    }
+  }
+  t2 = uptime();
+  for(i = 0; i < n; i++){
+    setname(i);
+    if(unlink(name) < 0){
+      printf("dirbench: unlink %s failed\n", name);
+      exit(-1);
+    }
+  }
+  t3 = uptime();
+
+  chdir("..");
+  unlink("dirbench.d");
+  printf("dirbench: create %d ticks, stat %d ticks, unlink %d ticks\n",
+         t1 - t0, t2 - t1, t3 - t2);
+  exit(0);
+}
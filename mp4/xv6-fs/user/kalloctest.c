@@ -0,0 +1,77 @@
+// Parallel fork/sbrk benchmark for the page allocator.
+// Several processes grow and shrink their heaps and fork
+// short-lived children at the same time; the elapsed ticks
+// and the kmem lock counters show how much they contend.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NCHILD  4
+#define NROUND  200
+#define NPAGE   64
+
+void
+worker(void)
+{
+  int i, j;
+  char *a;
+
+  for(i = 0; i < NROUND; i++){
+    a = sbrk(NPAGE * PGSIZE);
+    if(a == (char*)-1){
+      printf("kalloctest: sbrk failed\n");
+      exit(-1);
+    }
+    for(j = 0; j < NPAGE; j++)
+      a[j * PGSIZE] = i;
+    if(sbrk(-NPAGE * PGSIZE) == (char*)-1){
+      printf("kalloctest: sbrk shrink failed\n");
+      exit(-1);
+    }
+
+    if(i % 10 == 0){
+      int pid = fork();
+      if(pid < 0){
+        printf("kalloctest: fork failed\n");
+        exit(-1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, t0, t1;
+
+  n = NCHILD;
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  printf("kalloctest: %d processes, %d rounds of %d pages\n", n, NROUND, NPAGE);
+  lockstat();
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("kalloctest: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0)
+      worker();
+  }
+  for(i = 0; i < n; i++)
+    wait(0);
+  t1 = uptime();
+
+  lockstat();
+  printf("kalloctest: %d ticks\n", t1 - t0);
+  exit(0);
+}
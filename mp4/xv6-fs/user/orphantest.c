@@ -0,0 +1,96 @@
+// Crash test for the orphan list. It takes two boots:
+//   $ orphantest
+//   (the kernel stops with "log: crash test"; run make qemu again)
+//   $ orphantest check
+// The first run unlinks a big file, which goes on the orphan
+// list, and stops the kernel right after that transaction
+// commits, before it is installed. After the restart, recovery
+// installs it, and the reaper must free all of the file's
+// blocks, which the second run checks.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NBLK  300   // more than NDIRECT, so freed in the background
+
+char buf[BSIZE];
+
+void
+crash(void)
+{
+  int fd, big, i, n;
+
+  // create both files first, so that from n on only the
+  // blocks of the big one change hands.
+  n = 0;
+  if((fd = open("orphan.free", O_CREATE | O_WRONLY)) < 0 ||
+     write(fd, &n, sizeof(n)) != sizeof(n)){
+    printf("orphantest: cannot create orphan.free\n");
+    exit(-1);
+  }
+  close(fd);
+  if((big = open("orphan.big", O_CREATE | O_WRONLY)) < 0){
+    printf("orphantest: cannot create orphan.big\n");
+    exit(-1);
+  }
+  n = freeblocks();
+
+  for(i = 0; i < NBLK; i++){
+    if(write(big, buf, sizeof(buf)) != sizeof(buf)){
+      printf("orphantest: write orphan.big failed\n");
+      exit(-1);
+    }
+  }
+  close(big);
+
+  if((fd = open("orphan.free", O_WRONLY)) < 0 ||
+     write(fd, &n, sizeof(n)) != sizeof(n)){
+    printf("orphantest: cannot write orphan.free\n");
+    exit(-1);
+  }
+  fsync(fd);
+
+  printf("orphantest: %d free blocks; crashing\n", n);
+  logcrash();
+  unlink("orphan.big");
+  fsync(fd);
+  sleep(100);
+  printf("orphantest: did not crash\n");
+  exit(-1);
+}
+
+void
+check(void)
+{
+  int fd, i, n;
+
+  if((fd = open("orphan.free", O_RDONLY)) < 0 ||
+     read(fd, &n, sizeof(n)) != sizeof(n)){
+    printf("orphantest: cannot read orphan.free; run orphantest first\n");
+    exit(-1);
+  }
+  close(fd);
+
+  // give the reaper time to free the blocks.
+  for(i = 0; i < 100 && freeblocks() != n; i++)
+    sleep(10);
+  if(freeblocks() != n){
+    printf("orphantest: %d blocks lost\n", n - freeblocks());
+    exit(-1);
+  }
+  unlink("orphan.free");
+  printf("orphantest: ok\n");
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "check") == 0)
+    check();
+  crash();
+  exit(0);
+}
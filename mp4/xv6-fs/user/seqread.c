@@ -0,0 +1,72 @@
+// Sequential read benchmark.
+// Writes a file that reaches into the doubly-indirect blocks
+// and is bigger than the buffer cache, then times reading it
+// back in one pass. The start of the file has been evicted by
+// then, so each block is a disk read unless read-ahead has
+// already fetched it.
+// With -f, the file's blocks are preallocated by fallocate()
+// before it is written.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NBLK  20000   // blocks in the file, more than MAXBUF
+
+char buf[BSIZE];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, t0, t1, prealloc = 0;
+  char *name = "seqread.tmp";
+
+  if(argc > 1 && strcmp(argv[1], "-f") == 0){
+    prealloc = 1;
+    argc--;
+    argv++;
+  }
+  n = NBLK;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1)
+    n = NBLK;
+
+  if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+    printf("seqread: cannot create %s\n", name);
+    exit(-1);
+  }
+  if(prealloc && fallocate(fd, 0, n*BSIZE) < 0){
+    printf("seqread: fallocate failed\n");
+    exit(-1);
+  }
+  for(i = 0; i < n; i++){
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("seqread: write failed at block %d\n", i);
+      exit(-1);
+    }
+  }
+  close(fd);
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf("seqread: cannot open %s\n", name);
+    exit(-1);
+  }
+  printf("seqread: reading %d blocks\n", n);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != (char)i){
+      printf("seqread: read failed at block %d\n", i);
+      exit(-1);
+    }
+  }
+  t1 = uptime();
+  close(fd);
+  unlink(name);
+
+  printf("seqread: %d ticks\n", t1 - t0);
+  exit(0);
+}
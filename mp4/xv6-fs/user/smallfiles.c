@@ -0,0 +1,64 @@
+// Small-file benchmark for the log.
+// Creates, writes and deletes many one-block files, each
+// in a few short transactions, and reports the elapsed
+// ticks. With group commit (make COMMITDELAY=1) many of those
+// transactions share one commit. An fsync() at the end makes
+// them all durable.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFILE  200
+
+char buf[BSIZE];
+
+int
+main(int argc, char *argv[])
+{
+  char name[] = "sf000";
+  int fd, i, n, t0, t1;
+
+  n = NFILE;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > 1000)
+    n = NFILE;
+
+  printf("smallfiles: %d files\n", n);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    name[2] = '0' + i / 100;
+    name[3] = '0' + i / 10 % 10;
+    name[4] = '0' + i % 10;
+    if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+      printf("smallfiles: cannot create %s\n", name);
+      exit(-1);
+    }
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("smallfiles: write %s failed\n", name);
+      exit(-1);
+    }
+    if(i == n - 1 && fsync(fd) < 0){
+      printf("smallfiles: fsync failed\n");
+      exit(-1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < n; i++){
+    name[2] = '0' + i / 100;
+    name[3] = '0' + i / 10 % 10;
+    name[4] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("smallfiles: unlink %s failed\n", name);
+      exit(-1);
+    }
+  }
+  t1 = uptime();
+
+  printf("smallfiles: %d ticks\n", t1 - t0);
+  exit(0);
+}
@@ -0,0 +1,80 @@
+// Parallel path lookup benchmark.
+// Each process stats the same file, four directories deep, so
+// every lookup walks the same shared directories. lockstat()
+// before and after reports how many walks went through the
+// name cache without locks, and the lock spins.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NCHILD  4
+#define NROUND  2000
+
+char *dirs[] = { "sb.d", "sb.d/a", "sb.d/a/b", "sb.d/a/b/c" };
+char file[] = "sb.d/a/b/c/file";
+
+void
+statter(void)
+{
+  struct stat st;
+  int i;
+
+  for(i = 0; i < NROUND; i++){
+    if(stat(file, &st) < 0 || st.type != T_FILE){
+      printf("statbench: cannot stat %s\n", file);
+      exit(-1);
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, t0, t1;
+
+  n = NCHILD;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > 10)
+    n = NCHILD;
+
+  for(i = 0; i < sizeof(dirs)/sizeof(dirs[0]); i++){
+    if(mkdir(dirs[i]) < 0){
+      printf("statbench: cannot make %s\n", dirs[i]);
+      exit(-1);
+    }
+  }
+  if((fd = open(file, O_CREATE | O_WRONLY)) < 0){
+    printf("statbench: cannot create %s\n", file);
+    exit(-1);
+  }
+  close(fd);
+
+  printf("statbench: %d processes, %d stats\n", n, NROUND);
+  lockstat();
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("statbench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0)
+      statter();
+  }
+  for(i = 0; i < n; i++)
+    wait(0);
+  t1 = uptime();
+
+  lockstat();
+  printf("statbench: %d ticks\n", t1 - t0);
+
+  unlink(file);
+  for(i = sizeof(dirs)/sizeof(dirs[0]) - 1; i >= 0; i--)
+    unlink(dirs[i]);
+  exit(0);
+}
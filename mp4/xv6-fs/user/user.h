@@ -24,6 +24,11 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int symlink(char *target, char *path);
+int lockstat(void);
+int fsync(int);
+int fallocate(int, int, int);
+int logcrash(void);
+int freeblocks(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
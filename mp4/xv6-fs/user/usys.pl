@@ -37,3 +37,8 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("symlink");
+entry("lockstat");
+entry("fsync");
+entry("fallocate");
+entry("logcrash");
+entry("freeblocks");